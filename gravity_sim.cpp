@@ -5,6 +5,49 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
 #include <iostream>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+#include <iomanip>
+#include <fstream>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstdio>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#endif
+#include <cstring>
+#include <cstddef>
+#include <cstdlib>
+#include <cctype>
+#include <cassert>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <atomic>
+#include <sstream>
+#include <stdexcept>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#endif
 
 const char* vertexShaderSource = R"glsl(
 #version 330 core
@@ -27,18 +70,258 @@ out vec4 FragColor;
 uniform vec4 objectColor;
 uniform bool isGrid; // Add this uniform
 uniform bool GLOW;
+uniform float glowIntensity; // HDR, Bloom turns the excess into a halo
 void main() {
     if (isGrid) {
         // If it's the grid, use the original color without lighting
         FragColor = objectColor;
     } else if(GLOW){
-        FragColor = vec4(objectColor.rgb * 100000, objectColor.a);
+        FragColor = vec4(objectColor.rgb * glowIntensity, objectColor.a);
     }else {
         // If it's an object, apply the lighting effect
         float fade = smoothstep(0.0, 10.0, lightIntensity*10);
         FragColor = vec4(objectColor.rgb * fade, objectColor.a);
     }})glsl";
 
+// bodies under a couple of pixels on screen are batched into one GL_POINTS draw
+const char* pointVertexShaderSource = R"glsl(
+#version 330 core
+layout(location=0) in vec3 aPos;
+layout(location=1) in vec4 aColor;
+uniform mat4 view;
+uniform mat4 projection;
+out vec4 pointColor;
+void main() {
+    gl_Position = projection * view * vec4(aPos, 1.0);
+    pointColor = aColor;
+})glsl";
+
+const char* pointFragmentShaderSource = R"glsl(
+#version 330 core
+in vec4 pointColor;
+out vec4 FragColor;
+void main() {
+    FragColor = pointColor;
+})glsl";
+
+// impostors: one point sprite per body, the sphere is ray cast per pixel in view space
+const char* impostorVertexShaderSource = R"glsl(
+#version 330 core
+layout(location=0) in vec4 aSphere; // world centre, radius
+layout(location=1) in vec4 aColor;
+uniform mat4 view;
+uniform mat4 projection;
+uniform float viewportHeight;
+uniform float haloScale; // sprite size in sphere diameters, glow sprites cover a halo around it
+out vec3 centre;
+out float radius;
+out vec4 color;
+void main() {
+    centre = (view * vec4(aSphere.xyz, 1.0)).xyz;
+    radius = aSphere.w;
+    color = aColor;
+    gl_Position = projection * vec4(centre, 1.0);
+    gl_PointSize = haloScale * radius * projection[1][1] * viewportHeight / max(gl_Position.w, 1e-3) + 2.0;
+})glsl";
+
+const char* impostorFragmentShaderSource = R"glsl(
+#version 330 core
+in vec3 centre;
+in float radius;
+in vec4 color;
+out vec4 FragColor;
+uniform mat4 projection;
+uniform vec2 viewportSize;
+uniform vec3 lightPos; // world origin in view space, same light as the mesh shader
+uniform bool GLOW;
+uniform float glowIntensity;
+void main() {
+    // eye ray through this pixel against the sphere
+    vec2 ndc = gl_FragCoord.xy / viewportSize * 2.0 - 1.0;
+    vec3 ray = normalize(vec3(ndc.x / projection[0][0], ndc.y / projection[1][1], -1.0));
+    float b = dot(ray, centre);
+    float h = b * b - dot(centre, centre) + radius * radius;
+    if (GLOW) {
+        // solid core plus a halo falling off with the ray's closest approach, added on top
+        float miss = sqrt(max(dot(centre, centre) - b * b, 0.0)) / radius;
+        float halo = h >= 0.0 ? 1.0 : exp(-3.0 * (miss - 1.0));
+        if (halo < 0.01) discard;
+        FragColor = vec4(color.rgb * (h >= 0.0 ? glowIntensity : halo), color.a * halo);
+        // the core at the sphere's front, the halo where the ray passes closest to the centre
+        vec4 clip = projection * vec4(ray * (h >= 0.0 ? b - sqrt(h) : b), 1.0);
+        gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+        return;
+    }
+    if (h < 0.0) discard;
+    vec3 hit = ray * (b - sqrt(h));
+    vec3 normal = (hit - centre) / radius;
+    float lightIntensity = max(dot(normal, normalize(lightPos - hit)), 0.15);
+    float fade = smoothstep(0.0, 10.0, lightIntensity*10);
+    FragColor = vec4(color.rgb * fade, color.a);
+    vec4 clip = projection * vec4(hit, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+})glsl";
+
+// bodies stepped on the GPU (GpuPhysics) are drawn in one instanced call straight from its
+// buffers: the shared unit sphere per vertex, centre, radius, colour and glow per instance
+const char* instancedVertexShaderSource = R"glsl(
+#version 330 core
+layout(location=0) in vec3 aPos;
+layout(location=1) in vec4 aSphere; // world centre, radius
+layout(location=2) in vec4 aColor;
+layout(location=3) in float aGlow;
+uniform mat4 view;
+uniform mat4 projection;
+out float lightIntensity;
+out vec4 bodyColor;
+flat out int glow;
+void main() {
+    vec3 worldPos = aSphere.xyz + aPos * aSphere.w;
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+    vec3 normal = normalize(aPos);
+    vec3 dirToCenter = normalize(-worldPos);
+    lightIntensity = max(dot(normal, dirToCenter), 0.15);
+    bodyColor = aColor;
+    glow = aGlow > 0.5 ? 1 : 0;
+})glsl";
+
+const char* instancedFragmentShaderSource = R"glsl(
+#version 330 core
+in float lightIntensity;
+in vec4 bodyColor;
+flat in int glow;
+out vec4 FragColor;
+uniform float glowIntensity;
+void main() {
+    if (glow != 0) {
+        FragColor = vec4(bodyColor.rgb * glowIntensity, bodyColor.a);
+    } else {
+        float fade = smoothstep(0.0, 10.0, lightIntensity*10);
+        FragColor = vec4(bodyColor.rgb * fade, bodyColor.a);
+    }
+})glsl";
+
+// GpuPhysics compute passes. GpuPhysics::Start puts "#version 430" and the definition of real
+// (float, or double for --gpu-double) in front. The arithmetic is IntegrateKernel's, term for
+// term and in the same order (precise keeps the compiler from fusing it into fma), so in
+// double the GPU follows the CPU path to rounding.
+const char* kickComputeShaderSource = R"glsl(
+layout(local_size_x = 64) in;
+layout(std430, binding = 0) buffer Spheres { vec4 sphere[]; };     // world position, radius
+layout(std430, binding = 1) buffer Velocities { vec4 velocity[]; };
+layout(std430, binding = 2) buffer Sources { vec2 source[]; };     // mass (kg), 1 = stepped here
+uniform uint count;
+uniform real G;
+uniform real unitLength;    // m per world unit
+uniform real eps2;          // softening^2 in m^2, 0 for Newtonian
+uniform float kick;
+shared vec4 tileSphere[64];
+shared vec2 tileSource[64];
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    uint lane = gl_LocalInvocationID.x;
+    vec4 self = i < count ? sphere[i] : vec4(0.0);
+    realv pi = realv(self.xyz) * unitLength;
+    precise realv sum = realv(0.0);
+    uint bounces = 0u;
+    // the whole group walks the bodies 64 at a time through shared memory
+    for (uint tile = 0u; tile < count; tile += 64u) {
+        uint j = tile + lane;
+        tileSphere[lane] = j < count ? sphere[j] : vec4(0.0);
+        tileSource[lane] = j < count ? source[j] : vec2(0.0);
+        barrier();
+        uint n = min(64u, count - tile);
+        for (uint k = 0u; k < n; ++k) {
+            if (tile + k == i || tileSource[k].y == 0.0) continue;
+            vec4 other = tileSphere[k];
+            precise realv d = realv(other.xyz) * unitLength - pi;
+            if (d != realv(0.0)) {
+                precise real r2 = d.x * d.x + d.y * d.y + d.z * d.z + eps2;
+                precise real r = sqrt(r2);
+                sum += d * (G * real(tileSource[k].x) / (r2 * r));
+            }
+            precise vec3 dx = other.xyz - self.xyz;
+            precise float distance2 = dx.x * dx.x + dx.y * dx.y + dx.z * dx.z;
+            if (other.w + self.w > sqrt(distance2)) ++bounces;
+        }
+        barrier();
+    }
+    if (i >= count || source[i].y == 0.0) return;
+    precise vec3 v = velocity[i].xyz;
+    v += vec3(sum) * kick;
+    for (uint b = 0u; b < bounces; ++b) v *= -0.2;
+    velocity[i].xyz = v;
+})glsl";
+
+const char* driftComputeShaderSource = R"glsl(
+layout(local_size_x = 64) in;
+layout(std430, binding = 0) buffer Spheres { vec4 sphere[]; };
+layout(std430, binding = 1) buffer Velocities { vec4 velocity[]; };
+layout(std430, binding = 2) buffer Sources { vec2 source[]; };
+uniform uint count;
+uniform float drift;
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= count || source[i].y == 0.0) return;
+    precise vec3 p = sphere[i].xyz + velocity[i].xyz * drift;
+    sphere[i].xyz = p;
+})glsl";
+
+// bloom post-process, all passes are a single attributeless full-screen triangle
+const char* fullscreenVertexShaderSource = R"glsl(
+#version 330 core
+out vec2 uv;
+void main() {
+    uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+})glsl";
+
+// 4 bilinear taps = smoothed 4x4 box for a 2x downsample, keeping only what is above threshold
+const char* brightFragmentShaderSource = R"glsl(
+#version 330 core
+in vec2 uv;
+out vec4 FragColor;
+uniform sampler2D source;
+uniform vec2 texel;
+uniform float threshold;
+void main() {
+    vec3 c = 0.25 * (texture(source, uv + texel * vec2(-1.0, -1.0)).rgb
+                   + texture(source, uv + texel * vec2( 1.0, -1.0)).rgb
+                   + texture(source, uv + texel * vec2(-1.0,  1.0)).rgb
+                   + texture(source, uv + texel * vec2( 1.0,  1.0)).rgb);
+    float bright = max(c.r, max(c.g, c.b));
+    FragColor = vec4(c * (max(bright - threshold, 0.0) / max(bright, 1e-4)), 1.0);
+})glsl";
+
+// 9-tap gaussian along one axis folded into 5 bilinear fetches
+const char* blurFragmentShaderSource = R"glsl(
+#version 330 core
+in vec2 uv;
+out vec4 FragColor;
+uniform sampler2D source;
+uniform vec2 direction; // one texel along the blur axis
+void main() {
+    vec3 c = texture(source, uv).rgb * 0.2270270270;
+    c += (texture(source, uv + direction * 1.3846153846).rgb + texture(source, uv - direction * 1.3846153846).rgb) * 0.3162162162;
+    c += (texture(source, uv + direction * 3.2307692308).rgb + texture(source, uv - direction * 3.2307692308).rgb) * 0.0702702703;
+    FragColor = vec4(c, 1.0);
+})glsl";
+
+const char* compositeFragmentShaderSource = R"glsl(
+#version 330 core
+in vec2 uv;
+out vec4 FragColor;
+uniform sampler2D scene;
+uniform sampler2D bloom;
+uniform float bloomStrength;
+void main() {
+    vec3 c = texture(scene, uv).rgb + bloomStrength * texture(bloom, uv).rgb;
+    // identity up to the knee so ordinary colours look as before, highlights roll off to white
+    const float knee = 0.8;
+    c = min(c, knee) + (1.0 - knee) * (1.0 - exp(-max(c - knee, 0.0) / (1.0 - knee)));
+    FragColor = vec4(c, 1.0);
+})glsl";
+
 bool running = true;
 bool pause = true;
 glm::vec3 cameraPos   = glm::vec3(0.0f, 0.0f,  1.0f);
@@ -48,19 +331,188 @@ float lastX = 400.0, lastY = 300.0;
 float yaw = -90;
 float pitch =0.0;
 float deltaTime = 0.0;
-float lastFrame = 0.0;
+double lastFrame = 0.0;   // glfwGetTime() seconds, matching the input event stamps
 
 const double G = 6.6743e-11; // m^3 kg^-1 s^-2
 const float c = 299792458.0;
 float initMass = float(pow(10, 22));
-float sizeRatio = 30000.0f;
+thread_local float sizeRatio = 30000.0f;  // per thread so sweep runs can each use their own
+
+// unit systems: how world units map to metres and how big one step is
+struct SimUnits {
+    // 1 world unit = 1 km, with the tuned /96 kick and /94 drift per step
+    static constexpr double length = 1000.0;        // m per world unit
+    static constexpr double kick = 1.0 / 96.0;      // world velocity per (m/s^2)
+    static constexpr double drift = 1.0 / 94.0;     // world units per world velocity
+    static constexpr double velocity = 31.956;      // m/s per world velocity, sqrt(length*drift/kick)
+};
+struct SIUnits {
+    // world units are metres, one step is one second
+    static constexpr double length = 1.0;
+    static constexpr double kick = 1.0;
+    static constexpr double drift = 1.0;
+    static constexpr double velocity = 1.0;
+};
+
+// force laws, everything in SI: d = r_j - r_i (m), dv = v_j - v_i (m/s), Gm = G*m_j, eps = softening (m)
+struct Newtonian {
+    static glm::dvec3 Accel(const glm::dvec3& d, const glm::dvec3& dv, double Gm, double eps) {
+        double r2 = glm::dot(d, d);
+        double r = std::sqrt(r2);
+        return d * (Gm / (r2 * r));
+    }
+    static double Potential(const glm::dvec3& d, double Gm, double eps) {
+        return -Gm / std::sqrt(glm::dot(d, d));
+    }
+};
+struct PlummerSoftened {
+    static glm::dvec3 Accel(const glm::dvec3& d, const glm::dvec3& dv, double Gm, double eps) {
+        double r2 = glm::dot(d, d) + eps * eps;
+        double r = std::sqrt(r2);
+        return d * (Gm / (r2 * r));
+    }
+    static double Potential(const glm::dvec3& d, double Gm, double eps) {
+        return -Gm / std::sqrt(glm::dot(d, d) + eps * eps);
+    }
+};
+struct SplineSoftened {
+    // cubic spline kernel (Monaghan & Lattanzio), exactly Newtonian beyond h = 2.8 eps
+    static glm::dvec3 Accel(const glm::dvec3& d, const glm::dvec3& dv, double Gm, double eps) {
+        double r = std::sqrt(glm::dot(d, d));
+        double h = 2.8 * eps;
+        if (r >= h) return d * (Gm / (r * r * r));
+        double u = r / h;
+        double h3 = 1.0 / (h * h * h);
+        double fac;
+        if (u < 0.5) {
+            fac = h3 * (10.666666666667 + u * u * (32.0 * u - 38.4));
+        } else {
+            fac = h3 * (21.333333333333 - 48.0 * u + 38.4 * u * u - 10.666666666667 * u * u * u - 0.066666666667 / (u * u * u));
+        }
+        return d * (Gm * fac);
+    }
+    static double Potential(const glm::dvec3& d, double Gm, double eps) {
+        double r = std::sqrt(glm::dot(d, d));
+        double h = 2.8 * eps;
+        if (r >= h) return -Gm / r;
+        double u = r / h;
+        double wp;
+        if (u < 0.5) {
+            wp = -2.8 + u * u * (5.333333333333 + u * u * (6.4 * u - 9.6));
+        } else {
+            wp = -3.2 + 0.066666666667 / u + u * u * (10.666666666667 + u * (-16.0 + u * (9.6 - 2.133333333333 * u)));
+        }
+        return Gm * wp / h;
+    }
+};
+struct PostNewtonian {
+    // Newtonian plus the 1PN test-particle correction around m_j
+    static glm::dvec3 Accel(const glm::dvec3& d, const glm::dvec3& dv, double Gm, double eps) {
+        const double c2 = double(c) * double(c);
+        double r2 = glm::dot(d, d);
+        double r = std::sqrt(r2);
+        double pn = 1.0 - 4.0 * Gm / (r * c2) + glm::dot(dv, dv) / c2;
+        return (d * pn - dv * (4.0 * glm::dot(d, dv) / c2)) * (Gm / (r2 * r));
+    }
+    // monitored against the Newtonian potential, the 1PN terms show up as drift
+    static double Potential(const glm::dvec3& d, double Gm, double eps) {
+        return -Gm / std::sqrt(glm::dot(d, d));
+    }
+};
+
+enum class ForceLaw { Newtonian, Plummer, Spline, PostNewtonian };
+enum class UnitSystem { Sim, SI };
+ForceLaw forceLaw = ForceLaw::Newtonian;
+UnitSystem unitSystem = UnitSystem::Sim;
+float softening = 100.0f; // world units
+double stepScale = 1.0;     // step length as a multiple of the tuned Units step
+bool keplerMode = false;    // see KeplerStepKernel
+double keplerTolerance = 0.01;
+bool encounters = false;    // see FindEncounters
+double encounterSteps = 8.0;
+double encounterAccuracy = 0.02;    // substep as a fraction of the shortest pair time scale
+double encounterDeflection = 0.01;  // mu / (r v^2) a crossing pair needs to count, ~ half its deflection
+bool lodPhysics = false;    // see LodStepKernel
+float lodTheta = 0.1f;
+float lodLink = 5000.0f;    // world units
+int lodMinBodies = 8;
+int lodInterval = 32;
+const int maxEncounterSubsteps = 100000;
+
+// deterministic mode: fixed-step mass growth, compensated fixed-order sums, state hash every hashInterval steps
+bool deterministic = false;
+bool headless = false;
+int hashInterval = 100;
+const float fixedDt = 1.0f / 60.0f;
+uint64_t simStep = 0;
+uint32_t nextObjectId = 0;
+
+// debug builds count every heap allocation made on each thread, so StepPhysics can
+// report a steady-state step that makes any (build with -DNDEBUG to drop the hook)
+#ifndef NDEBUG
+thread_local uint64_t heapAllocations = 0;
+void* operator new(std::size_t n) {
+    ++heapAllocations;
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
+
+// bump allocator for scratch that only lives for one step: Reset() rewinds it and keeps
+// the memory, so once a step's high-water mark is reached it never goes back to the heap
+class FrameArena {
+    public:
+        ~FrameArena() {
+            for (auto& b : blocks) delete[] b.data;
+        }
+        template<class T> T* Allocate(size_t count) {
+            static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destructed");
+            const size_t align = alignof(std::max_align_t);
+            size_t bytes = (count * sizeof(T) + align - 1) & ~(align - 1);
+            if (blocks.empty() || offset + bytes > blocks.back().size) Grow(bytes);
+            T* p = reinterpret_cast<T*>(blocks.back().data + offset);
+            offset += bytes;
+            return p;
+        }
+        void Reset() {
+            // a step that spilled into several blocks gets one block big enough for all of it
+            if (blocks.size() > 1) {
+                size_t total = 0;
+                for (auto& b : blocks) {
+                    total += b.size;
+                    delete[] b.data;
+                }
+                blocks.assign(1, Block{ new unsigned char[total], total });
+            }
+            offset = 0;
+        }
+
+    private:
+        struct Block {
+            unsigned char* data;
+            size_t size;
+        };
+        std::vector<Block> blocks;
+        size_t offset = 0;
+
+        void Grow(size_t bytes) {
+            size_t size = std::max(bytes, blocks.empty() ? size_t(1) << 16 : blocks.back().size * 2);
+            blocks.push_back(Block{ new unsigned char[size], size });
+            offset = 0;
+        }
+};
+FrameArena frameArena;
 
 GLFWwindow* StartGLU();
 GLuint CreateShaderProgram(const char* vertexSource, const char* fragmentSource);
+GLuint CreateComputeProgram(const char* header, const char* source);
 void CreateVBOVAO(GLuint& VAO, GLuint& VBO, const float* vertices, size_t vertexCount);
 void UpdateCam(GLuint shaderProgram, glm::vec3 cameraPos);
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void HandleInput(GLFWwindow* window, double now);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -70,12 +522,13 @@ void DrawGrid(GLuint shaderProgram, GLuint gridVAO, size_t vertexCount);
 
 class Object {
     public:
-        GLuint VAO, VBO;
         glm::vec3 position = glm::vec3(400, 300, 0);
         glm::vec3 velocity = glm::vec3(0, 0, 0);
-        size_t vertexCount;
+        float meshRadius = 0.0f;    // scale of the shared unit sphere, set by EnsureMesh / UpdateVertices
         glm::vec4 color = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
 
+        uint32_t id;    // stable across re-sorts and runs, written to trajectories
+        uint32_t slot = 0;  // BodyRegistry slot, see BodyHandle
         bool Initalizing = false;
         bool Launched = false;
         bool target = false;
@@ -86,25 +539,28 @@ class Object {
 
         glm::vec3 LastPos = position;
         bool glow;
+        int32_t composite = -1;     // see Composite, -1 = integrated on its own
 
         Object(glm::vec3 initPosition, glm::vec3 initVelocity, float mass, float density = 3344, glm::vec4 color = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f), bool Glow = false) {   
             this->position = initPosition;
+            this->LastPos = initPosition;
             this->velocity = initVelocity;
             this->mass = mass;
             this->density = density;
             this->radius = pow(((3 * this->mass/this->density)/(4 * 3.14159265359)), (1.0f/3.0f)) / sizeRatio;
             this->color = color;
             this->glow = Glow;
-            
-
-            // generate vertices (centered at origin)
-            std::vector<float> vertices = Draw();
-            vertexCount = vertices.size();
+            this->id = nextObjectId++;
+        }
 
-            CreateVBOVAO(VAO, VBO, vertices.data(), vertexCount);
+        // every body draws the same unit sphere scaled by meshRadius, so creating a body
+        // costs no GPU upload at all; the scale is the radius at first draw, like a mesh built then
+        void EnsureMesh() {
+            if (meshRadius == 0.0f) meshRadius = radius;
         }
 
-        std::vector<float> Draw() {
+        // unit sphere (centered at origin), uploaded once by DrawScene
+        static std::vector<float> Draw() {
             std::vector<float> vertices;
             int stacks = 10;
             int sectors = 10;
@@ -116,76 +572,3558 @@ class Object {
                 for (float j = 0.0f; j < sectors; ++j){
                     float phi1 = j / sectors * 2 * glm::pi<float>();
                     float phi2 = (j+1) / sectors * 2 * glm::pi<float>();
-                    glm::vec3 v1 = sphericalToCartesian(this->radius, theta1, phi1);
-                    glm::vec3 v2 = sphericalToCartesian(this->radius, theta1, phi2);
-                    glm::vec3 v3 = sphericalToCartesian(this->radius, theta2, phi1);
-                    glm::vec3 v4 = sphericalToCartesian(this->radius, theta2, phi2);
+                    glm::vec3 v1 = sphericalToCartesian(1.0f, theta1, phi1);
+                    glm::vec3 v2 = sphericalToCartesian(1.0f, theta1, phi2);
+                    glm::vec3 v3 = sphericalToCartesian(1.0f, theta2, phi1);
+                    glm::vec3 v4 = sphericalToCartesian(1.0f, theta2, phi2);
+
+                    // Triangle 1: v1-v2-v3
+                    vertices.insert(vertices.end(), {v1.x, v1.y, v1.z}); //      /|
+                    vertices.insert(vertices.end(), {v2.x, v2.y, v2.z}); //     / |
+                    vertices.insert(vertices.end(), {v3.x, v3.y, v3.z}); //    /__|
+                    
+                    // Triangle 2: v2-v4-v3
+                    vertices.insert(vertices.end(), {v2.x, v2.y, v2.z});
+                    vertices.insert(vertices.end(), {v4.x, v4.y, v4.z});
+                    vertices.insert(vertices.end(), {v3.x, v3.y, v3.z});
+                }   
+            }
+            return vertices;
+        }
+        
+        void UpdatePos(float drift = 1.0f / 94){
+            this->position[0] += this->velocity[0] * drift;
+            this->position[1] += this->velocity[1] * drift;
+            this->position[2] += this->velocity[2] * drift;
+            this->radius = pow(((3 * this->mass/this->density)/(4 * 3.14159265359)), (1.0f/3.0f)) / sizeRatio;
+        }
+        void UpdateVertices() {
+            // draw at the current radius from now on
+            meshRadius = radius;
+        }
+        glm::vec3 GetPos() const {
+            return this->position;
+        }
+        void accelerate(float x, float y, float z, float kick = 1.0f / 96){
+            this->velocity[0] += x * kick;
+            this->velocity[1] += y * kick;
+            this->velocity[2] += z * kick;
+        }
+        float CheckCollision(const Object& other) {
+            float dx = other.position[0] - this->position[0];
+            float dy = other.position[1] - this->position[1];
+            float dz = other.position[2] - this->position[2];
+            float distance = std::pow(dx*dx + dy*dy + dz*dz, (1.0f/2.0f));
+            if (other.radius + this->radius > distance){
+                return -0.2f;
+            }
+            return 1.0f;
+        }
+};
+std::vector<Object> objs = {};
+
+std::vector<float> CreateGridVertices(float size, int divisions, const std::vector<Object>& objs);
+void UpdateGridVertices(std::vector<float>& vertices, const std::vector<Object>& objs);
+void DrawScene(GLuint shaderProgram, std::vector<float>& gridVertices);
+
+GLuint gridVAO, gridVBO;
+bool adaptiveGrid = false;      // see AdaptiveGrid
+int gridVertexBudget = 20000;
+bool culling = true;            // see Frustum and GridChunks, C toggles
+float spritePixels = 2.0f;      // bodies smaller than this on screen are drawn as points
+bool impostors = false;         // ray-cast point sprites instead of sphere meshes, I toggles
+bool bloom = true;              // see Bloom, B toggles
+float glowIntensity = 8.0f;     // HDR multiplier for glowing bodies
+float bloomThreshold = 1.0f;
+float bloomStrength = 0.6f;
+
+// spread the low 21 bits of v so there are two zero bits between each
+uint64_t SpreadBits(uint64_t v){
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+// z-order key of p inside the cube [lo, lo + extent]
+uint64_t MortonKey(const glm::vec3& p, const glm::vec3& lo, float extent){
+    float scale = extent > 0.0f ? 2097151.0f / extent : 0.0f;
+    auto cell = [scale](float x, float l) {
+        return uint64_t(std::min(std::max((x - l) * scale, 0.0f), 2097151.0f));
+    };
+    return SpreadBits(cell(p.x, lo.x)) | SpreadBits(cell(p.y, lo.y)) << 1 | SpreadBits(cell(p.z, lo.z)) << 2;
+}
+
+// slot map over objs: the kernels keep iterating a dense vector in whatever order suits them,
+// while tools and input code hold a BodyHandle. A handle names a slot plus the generation it
+// was issued for, so once its body is removed it resolves to nullptr instead of to whichever
+// body moved into the hole. Insert and Remove are O(1); Object::slot points back at the slot.
+struct BodyHandle {
+    uint32_t slot = 0xffffffffu;
+    uint32_t generation = 0;
+};
+
+class BodyRegistry {
+    public:
+        explicit BodyRegistry(std::vector<Object>& dense) : dense(dense) {}
+
+        BodyHandle Insert(const Object& obj) {
+            // grow ahead in big steps so a burst of spawns does not reallocate every few bodies
+            if (dense.size() == dense.capacity()) dense.reserve(std::max<size_t>(1024, dense.capacity() * 2));
+            uint32_t slot;
+            if (!freeSlots.empty()) {
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+            } else {
+                slot = uint32_t(slots.size());
+                slots.push_back(Slot{ 0, 0 });
+            }
+            slots[slot].index = uint32_t(dense.size());
+            dense.push_back(obj);
+            dense.back().slot = slot;
+            return BodyHandle{ slot, slots[slot].generation };
+        }
+        // the last body fills the hole, so dense order changes but no handle does
+        bool Remove(BodyHandle h) {
+            Object* obj = Get(h);
+            if (!obj) return false;
+            uint32_t index = slots[h.slot].index;
+            if (index + 1 != dense.size()) {
+                dense[index] = dense.back();
+                slots[dense[index].slot].index = index;
+            }
+            dense.pop_back();
+            ++slots[h.slot].generation;
+            freeSlots.push_back(h.slot);
+            return true;
+        }
+        Object* Get(BodyHandle h) {
+            if (h.slot >= slots.size() || slots[h.slot].generation != h.generation) return nullptr;
+            return &dense[slots[h.slot].index];
+        }
+        BodyHandle HandleOf(size_t index) const {
+            uint32_t slot = dense[index].slot;
+            return BodyHandle{ slot, slots[slot].generation };
+        }
+        // room for n bodies without reallocating; grows geometrically, so calling it before
+        // every batch keeps insertion amortised O(1)
+        void Reserve(size_t n) {
+            if (n > dense.capacity()) dense.reserve(std::max(n, dense.capacity() * 2));
+            if (n > slots.capacity()) slots.reserve(std::max(n, slots.capacity() * 2));
+        }
+        // take over whatever objs now holds (a new scene, a replay frame): every old handle dies
+        void Adopt() {
+            for (auto& slot : slots) ++slot.generation;
+            freeSlots.clear();
+            for (uint32_t s = uint32_t(slots.size()); s > dense.size(); --s) freeSlots.push_back(s - 1);
+            slots.resize(std::max(slots.size(), dense.size()));
+            for (size_t i = 0; i < dense.size(); ++i) {
+                dense[i].slot = uint32_t(i);
+                slots[i].index = uint32_t(i);
+            }
+        }
+        void Assign(std::vector<Object>&& scene) {
+            dense = std::move(scene);
+            Adopt();
+        }
+        // after the dense array was permuted in place
+        void Reindex() {
+            for (size_t i = 0; i < dense.size(); ++i) slots[dense[i].slot].index = uint32_t(i);
+        }
+
+    private:
+        struct Slot {
+            uint32_t index;
+            uint32_t generation;
+        };
+        std::vector<Object>& dense;
+        std::vector<Slot> slots;
+        std::vector<uint32_t> freeSlots;
+};
+BodyRegistry registry(objs);
+BodyHandle placing;     // the body being sized and positioned with the mouse, if any
+
+// periodic Morton re-sort of objs so neighbours in space are neighbours in memory;
+// handles survive the shuffle, the registry is re-pointed afterwards
+int sortInterval = 0;   // steps between re-sorts, 0 = off
+
+void SortByMorton(std::vector<Object>& objs){
+    size_t n = objs.size();
+    if (n < 2) return;
+
+    glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < n; ++i) {
+        lo = glm::min(lo, objs[i].position);
+        hi = glm::max(hi, objs[i].position);
+    }
+    glm::vec3 extent = hi - lo;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+
+    std::pair<uint64_t, size_t>* keys = frameArena.Allocate<std::pair<uint64_t, size_t>>(n);
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = { MortonKey(objs[i].position, lo, size), i };
+    }
+    std::sort(keys, keys + n);
+
+    // slot i takes objs[keys[i].second]; walk each cycle of the permutation once, in place
+    bool* placed = frameArena.Allocate<bool>(n);
+    std::fill(placed, placed + n, false);
+    for (size_t i = 0; i < n; ++i) {
+        if (placed[i]) continue;
+        Object held = std::move(objs[i]);
+        size_t j = i;
+        while (keys[j].second != i) {
+            objs[j] = std::move(objs[keys[j].second]);
+            placed[j] = true;
+            j = keys[j].second;
+        }
+        objs[j] = std::move(held);
+        placed[j] = true;
+    }
+    registry.Reindex();
+}
+
+// bounding volume hierarchy over the body spheres, for picking. The physics has no tree to
+// borrow (forces are a direct sum), so this one is built the cheap way: body indices sorted by
+// Morton key and the range halved recursively down to leafSize bodies, one sort per build and a
+// balanced tree. Between builds the boxes are refitted bottom-up in O(N), children always sit
+// after their parent so one backwards pass does it. Bodies drift out of Morton order and the
+// boxes loosen, so it is rebuilt every rebuildInterval refits or when the body count changes.
+class BodyBVH {
+    public:
+        static constexpr uint32_t leafSize = 4;
+        int rebuildInterval = 64;
+
+        // step is the simulation step the positions belong to, nothing is redone while paused
+        void Update(const std::vector<Object>& objs, uint64_t step) {
+            if (objs.size() == order.size() && step == fittedStep) return;
+            fittedStep = step;
+            if (objs.size() != order.size() || ++refits >= rebuildInterval) {
+                Build(objs);
+                refits = 0;
+            }
+            Refit(objs);
+        }
+
+        // closest body whose sphere the ray enters, each radius widened by tanTolerance per unit
+        // of distance from origin so sub-pixel bodies can be hit too; -1 if the ray misses all.
+        // Children are visited near first and anything starting beyond the best hit is skipped.
+        int64_t Pick(const std::vector<Object>& objs, glm::vec3 origin, glm::vec3 dir, float tanTolerance) const {
+            if (nodes.empty() || objs.size() != order.size()) return -1;
+            glm::vec3 inv = 1.0f / dir;
+            int64_t best = -1;
+            float bestT = std::numeric_limits<float>::max();
+            uint32_t stack[64];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                const Node& node = nodes[stack[--top]];
+                float t;
+                if (!Enter(node, origin, inv, tanTolerance, t) || t > bestT) continue;
+                if (node.count > 0) {
+                    for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+                        const Object& obj = objs[order[k]];
+                        glm::vec3 v = obj.position - origin;
+                        float along = glm::dot(v, dir);
+                        float dist2 = glm::dot(v, v);
+                        float r = obj.radius + tanTolerance * std::sqrt(dist2);
+                        float miss2 = dist2 - along * along;
+                        if (along < 0.0f || miss2 > r * r) continue;
+                        float hit = std::max(0.0f, along - std::sqrt(r * r - miss2));
+                        if (hit < bestT) {
+                            bestT = hit;
+                            best = int64_t(order[k]);
+                        }
+                    }
+                    continue;
+                }
+                float tl, tr;
+                bool l = Enter(nodes[node.left], origin, inv, tanTolerance, tl);
+                bool r = Enter(nodes[node.right], origin, inv, tanTolerance, tr);
+                // far child first on the stack so the near one is searched first
+                if (l && r && tl < tr) {
+                    stack[top++] = node.right;
+                    stack[top++] = node.left;
+                } else {
+                    if (l) stack[top++] = node.left;
+                    if (r) stack[top++] = node.right;
+                }
+            }
+            return best;
+        }
+
+    private:
+        struct Node {
+            glm::vec3 lo, hi;
+            uint32_t first, count;  // count > 0: leaf over order[first, first + count)
+            uint32_t left, right;
+        };
+        std::vector<Node> nodes;
+        std::vector<uint32_t> order;
+        std::vector<std::pair<uint64_t, uint32_t>> keys;
+        int refits = 0;
+        uint64_t fittedStep = ~0ull;
+
+        void Build(const std::vector<Object>& objs) {
+            size_t n = objs.size();
+            order.resize(n);
+            nodes.clear();
+            if (n == 0) return;
+            glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+            for (const auto& obj : objs) {
+                lo = glm::min(lo, obj.position);
+                hi = glm::max(hi, obj.position);
+            }
+            glm::vec3 extent = hi - lo;
+            float size = std::max(extent.x, std::max(extent.y, extent.z));
+            keys.resize(n);
+            for (size_t i = 0; i < n; ++i) keys[i] = { MortonKey(objs[i].position, lo, size), uint32_t(i) };
+            std::sort(keys.begin(), keys.end());
+            for (size_t i = 0; i < n; ++i) order[i] = keys[i].second;
+            nodes.reserve(2 * (n / leafSize + 1));
+            Split(0, uint32_t(n));
+        }
+        uint32_t Split(uint32_t first, uint32_t count) {
+            uint32_t index = uint32_t(nodes.size());
+            nodes.push_back(Node{ glm::vec3(0.0f), glm::vec3(0.0f), first, count, 0, 0 });
+            if (count > leafSize) {
+                uint32_t half = count / 2;
+                nodes[index].count = 0;
+                uint32_t left = Split(first, half);
+                uint32_t right = Split(first + half, count - half);
+                nodes[index].left = left;
+                nodes[index].right = right;
+            }
+            return index;
+        }
+        void Refit(const std::vector<Object>& objs) {
+            for (size_t k = nodes.size(); k-- > 0;) {
+                Node& node = nodes[k];
+                if (node.count > 0) {
+                    node.lo = glm::vec3(std::numeric_limits<float>::max());
+                    node.hi = glm::vec3(-std::numeric_limits<float>::max());
+                    for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                        const Object& obj = objs[order[i]];
+                        node.lo = glm::min(node.lo, obj.position - glm::vec3(obj.radius));
+                        node.hi = glm::max(node.hi, obj.position + glm::vec3(obj.radius));
+                    }
+                } else {
+                    node.lo = glm::min(nodes[node.left].lo, nodes[node.right].lo);
+                    node.hi = glm::max(nodes[node.left].hi, nodes[node.right].hi);
+                }
+            }
+        }
+        // slab test against the box grown by the tolerance at its far corner; t is the entry distance
+        static bool Enter(const Node& node, glm::vec3 origin, glm::vec3 inv, float tanTolerance, float& t) {
+            glm::vec3 far = glm::max(glm::abs(node.lo - origin), glm::abs(node.hi - origin));
+            glm::vec3 grow(tanTolerance * std::sqrt(glm::dot(far, far)));
+            glm::vec3 t0 = (node.lo - grow - origin) * inv;
+            glm::vec3 t1 = (node.hi + grow - origin) * inv;
+            glm::vec3 near = glm::min(t0, t1), exit = glm::max(t0, t1);
+            t = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+            return t <= std::min(exit.x, std::min(exit.y, exit.z));
+        }
+};
+
+// classical elements of a two-body orbit from the relative state, SI and radians. The reference
+// plane is the simulation's xz plane (y up), angles measured from +x.
+struct OrbitalElements {
+    double semiMajorAxis = 0.0;     // negative when unbound
+    double eccentricity = 0.0;
+    double inclination = 0.0;
+    double ascendingNode = 0.0;
+    double periapsis = 0.0;         // argument of periapsis
+    double trueAnomaly = 0.0;
+    double period = 0.0;            // 0 when unbound
+};
+
+OrbitalElements ComputeElements(const glm::dvec3& r, const glm::dvec3& v, double mu){
+    const double pi = 3.14159265358979323846;
+    auto angle = [](const glm::dvec3& a, const glm::dvec3& b) {
+        double d = glm::length(a) * glm::length(b);
+        return d > 0.0 ? std::acos(glm::clamp(glm::dot(a, b) / d, -1.0, 1.0)) : 0.0;
+    };
+    OrbitalElements el;
+    const glm::dvec3 up(0.0, 1.0, 0.0), ref(1.0, 0.0, 0.0);
+    glm::dvec3 h = glm::cross(r, v);
+    glm::dvec3 node = glm::cross(up, h);
+    glm::dvec3 ecc = glm::cross(v, h) / mu - r / glm::length(r);
+    double energy = 0.5 * glm::dot(v, v) - mu / glm::length(r);
+    el.eccentricity = glm::length(ecc);
+    el.semiMajorAxis = -mu / (2.0 * energy);
+    el.inclination = angle(h, up);
+    if (energy < 0.0) el.period = 2.0 * pi * std::sqrt(el.semiMajorAxis * el.semiMajorAxis * el.semiMajorAxis / mu);
+
+    // equatorial orbits have no node, circular ones no periapsis: fall back to +x and the node
+    const double tiny = 1e-9;
+    bool equatorial = glm::length(node) < tiny * glm::length(h);
+    bool circular = el.eccentricity < tiny;
+    glm::dvec3 line = equatorial ? ref : node;
+    if (!equatorial) el.ascendingNode = std::atan2(-node.z, node.x);
+    if (el.ascendingNode < 0.0) el.ascendingNode += 2.0 * pi;
+    glm::dvec3 periapsisDir = circular ? line : ecc;
+    if (!circular) {
+        el.periapsis = angle(line, ecc);
+        if (glm::dot(glm::cross(line, ecc), h) < 0.0) el.periapsis = 2.0 * pi - el.periapsis;
+    }
+    el.trueAnomaly = angle(periapsisDir, r);
+    if (glm::dot(glm::cross(periapsisDir, r), h) < 0.0) el.trueAnomaly = 2.0 * pi - el.trueAnomaly;
+    return el;
+}
+
+// Stumpff functions, with their series near z = 0 where the closed forms cancel
+double StumpffC(double z){
+    if (z > 1e-2) return (1.0 - std::cos(std::sqrt(z))) / z;
+    if (z < -1e-2) return (std::cosh(std::sqrt(-z)) - 1.0) / -z;
+    return 0.5 - z * (1.0 / 24.0 - z * (1.0 / 720.0 - z / 40320.0));
+}
+double StumpffS(double z){
+    if (z > 1e-2) {
+        double s = std::sqrt(z);
+        return (s - std::sin(s)) / (s * s * s);
+    }
+    if (z < -1e-2) {
+        double s = std::sqrt(-z);
+        return (std::sinh(s) - s) / (s * s * s);
+    }
+    return 1.0 / 6.0 - z * (1.0 / 120.0 - z * (1.0 / 5040.0 - z / 362880.0));
+}
+
+// advances the relative state (r, v) of a two-body orbit by dt along the exact conic, any
+// eccentricity, with the universal anomaly chi solved by Laguerre-Conway iteration and the
+// f and g functions. SI. Returns false (r, v untouched) if chi does not converge.
+bool KeplerDrift(glm::dvec3& r, glm::dvec3& v, double mu, double dt){
+    const double pi = 3.14159265358979323846;
+    double r0 = glm::length(r);
+    double sqrtMu = std::sqrt(mu);
+    double radial = glm::dot(r, v) / sqrtMu;          // r0 vr0 / sqrt(mu)
+    double alpha = 2.0 / r0 - glm::dot(v, v) / mu;    // 1 / a
+    if (alpha > 0.0) {
+        // whole revolutions change nothing, and keep chi small
+        double period = 2.0 * pi / (sqrtMu * alpha * std::sqrt(alpha));
+        dt = std::fmod(dt, period);
+    }
+
+    double chi = alpha > 0.0 ? sqrtMu * alpha * dt : sqrtMu * dt / r0;
+    double z = 0.0, C = 0.5, S = 1.0 / 6.0;
+    bool converged = false;
+    for (int iteration = 0; iteration < 50 && !converged; ++iteration) {
+        z = alpha * chi * chi;
+        C = StumpffC(z);
+        S = StumpffS(z);
+        double F = radial * chi * chi * C + (1.0 - alpha * r0) * chi * chi * chi * S + r0 * chi - sqrtMu * dt;
+        double dF = radial * chi * (1.0 - z * S) + (1.0 - alpha * r0) * chi * chi * C + r0;
+        double ddF = radial * (1.0 - z * C) + (1.0 - alpha * r0) * chi * (1.0 - z * S);
+        const double m = 5.0;
+        double root = std::sqrt(std::abs((m - 1.0) * (m - 1.0) * dF * dF - m * (m - 1.0) * F * ddF));
+        double step = m * F / (dF + (dF < 0.0 ? -root : root));
+        chi -= step;
+        converged = std::abs(step) <= 1e-13 * std::max(1.0, std::abs(chi));
+    }
+    if (!converged || !std::isfinite(chi)) return false;
+    z = alpha * chi * chi;
+    C = StumpffC(z);
+    S = StumpffS(z);
+
+    double f = 1.0 - chi * chi / r0 * C;
+    double g = dt - chi * chi * chi * S / sqrtMu;
+    glm::dvec3 r1 = f * r + g * v;
+    double r1n = glm::length(r1);
+    double fdot = sqrtMu / (r1n * r0) * (alpha * chi * chi * chi * S - chi);
+    double gdot = 1.0 - chi * chi / r1n * C;
+    v = fdot * r + gdot * v;
+    r = r1;
+    return true;
+}
+
+// closest approach of the conic through the relative state (r, v), SI; 0 for a radial orbit
+double Pericentre(const glm::dvec3& r, const glm::dvec3& v, double mu){
+    glm::dvec3 h = glm::cross(r, v);
+    glm::dvec3 e = glm::cross(v, h) / mu - r / glm::length(r);
+    return glm::dot(h, h) / mu / (1.0 + glm::length(e));
+}
+
+// the body pulling hardest on objs[i], SIZE_MAX if there is none
+size_t DominantAttractor(const std::vector<Object>& objs, size_t i){
+    size_t best = SIZE_MAX;
+    double bestPull = 0.0;
+    for (size_t j = 0; j < objs.size(); ++j) {
+        if (j == i || objs[j].Initalizing) continue;
+        glm::vec3 d = objs[j].position - objs[i].position;
+        double r2 = glm::dot(d, d);
+        double pull = r2 > 0.0 ? objs[j].mass / r2 : 0.0;
+        if (pull > bestPull) {
+            bestPull = pull;
+            best = j;
+        }
+    }
+    return best;
+}
+
+// mass, speed and orbit of objs[i] around its dominant attractor; one line with brief, the
+// window title form, otherwise a multi-line report
+void Inspect(const std::vector<Object>& objs, size_t i, std::ostream& out, bool brief){
+    const double length = unitSystem == UnitSystem::SI ? SIUnits::length : SimUnits::length;
+    const double velocity = unitSystem == UnitSystem::SI ? SIUnits::velocity : SimUnits::velocity;
+    const double degrees = 180.0 / 3.14159265358979323846;
+    const Object& obj = objs[i];
+    double speed = glm::length(glm::dvec3(obj.velocity)) * velocity;
+    out<<std::setprecision(4)<<"body "<<obj.id<<"  m="<<obj.mass<<" kg  |v|="<<speed<<" m/s";
+    if (!brief) {
+        out<<"\n  position ("<<obj.position.x<<", "<<obj.position.y<<", "<<obj.position.z<<")"
+           <<"  velocity ("<<obj.velocity.x<<", "<<obj.velocity.y<<", "<<obj.velocity.z<<")"
+           <<"  radius "<<obj.radius<<" (world units)";
+    }
+    size_t j = DominantAttractor(objs, i);
+    if (j != SIZE_MAX) {
+        const Object& host = objs[j];
+        glm::dvec3 r = (glm::dvec3(obj.position) - glm::dvec3(host.position)) * length;
+        glm::dvec3 v = (glm::dvec3(obj.velocity) - glm::dvec3(host.velocity)) * velocity;
+        OrbitalElements el = ComputeElements(r, v, G * (double(obj.mass) + double(host.mass)));
+        if (brief) {
+            out<<"  around "<<host.id<<": a="<<el.semiMajorAxis<<" m e="<<el.eccentricity;
+        } else {
+            out<<"\n  around body "<<host.id<<" (m="<<host.mass<<" kg, r="<<glm::length(r)<<" m)"
+               <<"\n  a="<<el.semiMajorAxis<<" m  e="<<el.eccentricity<<"  i="<<el.inclination * degrees
+               <<" deg  node="<<el.ascendingNode * degrees<<" deg  periapsis="<<el.periapsis * degrees
+               <<" deg  true anomaly="<<el.trueAnomaly * degrees<<" deg";
+            if (el.period > 0.0) out<<"  period="<<el.period<<" s";
+            else out<<"  (unbound)";
+        }
+    }
+    out<<std::setprecision(6);
+    if (!brief) out<<std::endl;
+}
+
+// hover inspector, H toggles: the body under the crosshair is highlighted and summarised in the
+// window title, a middle click prints the full report
+bool inspecting = false;
+BodyBVH pickTree;
+BodyHandle hovered;
+
+void UpdateHover(GLFWwindow* window){
+    if (Object* last = registry.Get(hovered)) last->target = false;
+    hovered = BodyHandle();
+    if (!inspecting) return;
+    // the cursor is captured, so the pick ray is the view axis; 3 pixels of slack at 45 degrees fov
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float tanTolerance = 3.0f * 2.0f * std::tan(glm::radians(22.5f)) / float(std::max(viewport[3], 1));
+    pickTree.Update(objs, simStep);
+    int64_t picked = pickTree.Pick(objs, cameraPos, cameraFront, tanTolerance);
+    if (picked >= 0) {
+        objs[picked].target = true;
+        hovered = registry.HandleOf(size_t(picked));
+    }
+    // the title is refreshed a few times a second, the attractor search is O(N)
+    static double lastTitle = 0.0;
+    double now = glfwGetTime();
+    if (now - lastTitle < 0.25) return;
+    lastTitle = now;
+    static std::ostringstream title;
+    title.str("");
+    if (picked >= 0) Inspect(objs, size_t(picked), title, true);
+    else title<<"nothing under the crosshair";
+    glfwSetWindowTitle(window, title.str().c_str());
+}
+
+// conservation monitor sample, all in SI
+struct Diagnostics {
+    uint64_t step = 0;
+    double kinetic = 0.0;
+    double potential = 0.0;
+    glm::dvec3 momentum = glm::dvec3(0.0);
+    glm::dvec3 angularMomentum = glm::dvec3(0.0);
+    double energyError = 0.0;   // (E - E0) / |E0|
+};
+
+// a body owned by another rank (or a whole remote domain as its monopole), world units like Object
+struct Ghost {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    float mass;
+    float radius;
+    bool Initalizing = false;
+};
+
+// pair loop shared by forces and the potential, so the monitor costs one extra
+// Law::Potential per pair on sample steps and nothing otherwise. Adds the pull of
+// sources on every body in objs; Self means sources is objs itself.
+template<class Law, class Units, bool Compensated, bool WithPotential, bool Self, class Source>
+double AccumulateForces(const std::vector<Object>& objs, const std::vector<Source>& sources, std::vector<glm::dvec3>& acc, double epsM){
+    double potential = 0.0;
+    for (size_t i = 0; i < objs.size(); ++i) {
+        if (objs[i].Initalizing) continue;
+        glm::dvec3 pi = glm::dvec3(objs[i].position) * Units::length;
+        glm::dvec3 vi = glm::dvec3(objs[i].velocity) * Units::velocity;
+        glm::dvec3 sum(0.0), comp(0.0);
+        double phi = 0.0;
+        for (size_t j = 0; j < sources.size(); ++j) {
+            if ((Self && j == i) || sources[j].Initalizing) continue;
+            glm::dvec3 d = glm::dvec3(sources[j].position) * Units::length - pi;
+            if (d.x == 0.0 && d.y == 0.0 && d.z == 0.0) continue;
+            glm::dvec3 dv = glm::dvec3(sources[j].velocity) * Units::velocity - vi;
+            glm::dvec3 a = Law::Accel(d, dv, G * sources[j].mass, epsM);
+            if constexpr (Compensated) {
+                glm::dvec3 y = a - comp;
+                glm::dvec3 t = sum + y;
+                comp = (t - sum) - y;
+                sum = t;
+            } else {
+                sum += a;
+            }
+            if constexpr (WithPotential) {
+                phi += Law::Potential(d, G * sources[j].mass, epsM);
+            }
+        }
+        acc[i] += sum;
+        // every pair is visited twice
+        if constexpr (WithPotential) potential += 0.5 * objs[i].mass * phi;
+    }
+    return potential;
+}
+
+template<class Units>
+void MeasureDiagnostics(const std::vector<Object>& objs, Diagnostics& diag){
+    diag.kinetic = 0.0;
+    diag.momentum = glm::dvec3(0.0);
+    diag.angularMomentum = glm::dvec3(0.0);
+    for (const auto& obj : objs) {
+        if (obj.Initalizing) continue;
+        glm::dvec3 r = glm::dvec3(obj.position) * Units::length;
+        glm::dvec3 v = glm::dvec3(obj.velocity) * Units::velocity;
+        diag.kinetic += 0.5 * obj.mass * glm::dot(v, v);
+        diag.momentum += v * double(obj.mass);
+        diag.angularMomentum += glm::cross(r, v) * double(obj.mass);
+    }
+}
+
+// close encounters: a pair whose two-body time scale (free-fall sqrt(r^3/mu) or crossing r/v)
+// is under encounterSteps global steps is not resolved by the global step. Such pairs are
+// joined into subgroups (union-find, so a binary meeting a third body is one group of three),
+// their mutual pulls are taken out of the global kick and each group is advanced over the
+// global drift as an isolated system: a Newtonian pair along its exact conic (KeplerDrift, the
+// universal anomaly is the regularised time), anything else by a leapfrog whose substep follows
+// the smallest pair time scale in the group (a Sundman-style time transform). The rest of the
+// system keeps the large global step. A fast pair only counts if it bends the pair's path by
+// more than encounterDeflection, otherwise one kick captures it and in a dense cluster the
+// crossing test alone links everything into one group. Pairs that touch or will touch on their
+// conic are left to the kick, whose collision bounce the sub-integrator does not have.
+struct EncounterGroups {
+    std::vector<uint32_t> parent;   // union-find over bodies
+    std::vector<int32_t> group;     // group of each body, -1 if none
+    std::vector<uint32_t> members;  // bodies of group g at members[start[g], start[g + 1])
+    std::vector<uint32_t> start;
+    // scratch for the member listing and DriftEncounterGroup, kept with the groups so a step
+    // where the first group forms does not allocate
+    std::vector<uint32_t> cursor;
+    std::vector<glm::dvec3> x, v, a;
+    std::vector<double> m;
+    size_t Count() const { return start.empty() ? 0 : start.size() - 1; }
+
+    uint32_t Find(uint32_t i) {
+        while (parent[i] != i) i = parent[i] = parent[parent[i]];
+        return i;
+    }
+};
+
+// the global step in seconds and the G scale that keeps the tuned kick and drift consistent,
+// see KeplerStepKernel
+template<class Units>
+double DriftSeconds(){ return Units::length * Units::drift / Units::velocity * stepScale; }
+template<class Units>
+double KickScale(){ return Units::velocity * Units::kick * stepScale / DriftSeconds<Units>(); }
+
+// Stored velocities trail positions by half a step (kick then drift is leapfrog). A group
+// member is brought level with a half kick of its group's pulls before its group drifts
+// (DriftEncounterGroup) and set back half a kick afterwards. So its own kick keeps half
+// of the internal pulls; across consecutive steps in a group the halves cancel to exactly
+// the external kick.
+
+// fills groups and takes half of every group's internal pulls out of acc
+template<class Law, class Units>
+void FindEncounters(const std::vector<Object>& objs, std::vector<glm::dvec3>& acc, double epsM, EncounterGroups& groups){
+    const size_t n = objs.size();
+    const double horizon = encounterSteps * DriftSeconds<Units>();
+    // sized for every body up front, so groups forming later in a run do not allocate
+    groups.parent.resize(n);
+    groups.group.assign(n, -1);
+    groups.members.clear();
+    groups.members.reserve(n);
+    groups.start.clear();
+    groups.start.reserve(n + 1);
+    groups.cursor.reserve(n);
+    groups.x.reserve(n);
+    groups.v.reserve(n);
+    groups.a.reserve(n);
+    groups.m.reserve(n);
+    for (size_t i = 0; i < n; ++i) groups.parent[i] = uint32_t(i);
+    bool any = false;
+    for (size_t i = 0; i < n; ++i) {
+        if (objs[i].Initalizing) continue;
+        for (size_t j = i + 1; j < n; ++j) {
+            if (objs[j].Initalizing) continue;
+            glm::dvec3 d = (glm::dvec3(objs[j].position) - glm::dvec3(objs[i].position)) * Units::length;
+            glm::dvec3 dv = (glm::dvec3(objs[j].velocity) - glm::dvec3(objs[i].velocity)) * Units::velocity;
+            double r = glm::length(d);
+            double mu = G * (double(objs[i].mass) + double(objs[j].mass));
+            // tau < horizon, squared to stay clear of the square roots
+            double u2 = glm::dot(dv, dv);
+            bool fall = r * r * r < horizon * horizon * mu;
+            bool cross = r * r < horizon * horizon * u2 && mu > encounterDeflection * r * u2;
+            if (!fall && !cross) continue;
+            double contact = (double(objs[i].radius) + double(objs[j].radius)) * Units::length;
+            if (r > contact && Pericentre(d, dv, mu) > contact) {
+                groups.parent[groups.Find(uint32_t(i))] = groups.Find(uint32_t(j));
+                any = true;
+            }
+        }
+    }
+    if (!any) return;
+
+    // number the roots that have members, then list the members group by group
+    std::vector<uint32_t>& count = groups.start;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t root = groups.Find(uint32_t(i));
+        if (root == i) continue;
+        if (groups.group[root] < 0) {
+            groups.group[root] = int32_t(count.size());
+            count.push_back(0);
+        }
+        groups.group[i] = groups.group[root];
+    }
+    count.assign(count.size() + 1, 0);
+    for (size_t i = 0; i < n; ++i) if (groups.group[i] >= 0) ++count[groups.group[i] + 1];
+    for (size_t g = 1; g < count.size(); ++g) count[g] += count[g - 1];
+    groups.members.resize(count.back());
+    std::vector<uint32_t>& cursor = groups.cursor;
+    cursor.assign(count.begin(), count.end() - 1);
+    for (size_t i = 0; i < n; ++i) {
+        if (groups.group[i] >= 0) groups.members[cursor[groups.group[i]]++] = uint32_t(i);
+    }
+
+    for (size_t g = 0; g < groups.Count(); ++g) {
+        for (uint32_t a = groups.start[g]; a < groups.start[g + 1]; ++a) {
+            uint32_t i = groups.members[a];
+            glm::dvec3 pi = glm::dvec3(objs[i].position) * Units::length;
+            glm::dvec3 vi = glm::dvec3(objs[i].velocity) * Units::velocity;
+            for (uint32_t b = groups.start[g]; b < groups.start[g + 1]; ++b) {
+                uint32_t j = groups.members[b];
+                if (j == i) continue;
+                glm::dvec3 d = glm::dvec3(objs[j].position) * Units::length - pi;
+                if (d.x == 0.0 && d.y == 0.0 && d.z == 0.0) continue;
+                glm::dvec3 dv = glm::dvec3(objs[j].velocity) * Units::velocity - vi;
+                acc[i] -= 0.5 * Law::Accel(d, dv, G * objs[j].mass, epsM);
+            }
+        }
+    }
+}
+
+// advances group g of groups in isolation over one global drift, its centre of mass moving straight
+template<class Law, class Units>
+void DriftEncounterGroup(std::vector<Object>& objs, EncounterGroups& groups, size_t g, double epsM){
+    const double dt = DriftSeconds<Units>();
+    const double scale = KickScale<Units>();
+    const uint32_t* first = groups.members.data() + groups.start[g];
+    const size_t k = groups.start[g + 1] - groups.start[g];
+
+    std::vector<glm::dvec3>& x = groups.x;
+    std::vector<glm::dvec3>& v = groups.v;
+    std::vector<glm::dvec3>& a = groups.a;
+    std::vector<double>& m = groups.m;
+    x.resize(k);
+    v.resize(k);
+    a.resize(k);
+    m.resize(k);
+    double total = 0.0;
+    glm::dvec3 com(0.0), comV(0.0);
+    for (size_t q = 0; q < k; ++q) {
+        const Object& obj = objs[first[q]];
+        m[q] = obj.mass;
+        x[q] = glm::dvec3(obj.position) * Units::length;
+        v[q] = glm::dvec3(obj.velocity) * Units::velocity;
+        total += m[q];
+        com += x[q] * m[q];
+        comV += v[q] * m[q];
+    }
+    com /= total;
+    comV /= total;
+    for (size_t q = 0; q < k; ++q) {
+        x[q] -= com;
+        v[q] -= comV;
+    }
+
+    bool done = false;
+    if (k == 2 && std::is_same<Law, Newtonian>::value) {
+        glm::dvec3 r = x[1] - x[0], u = v[1] - v[0];
+        double contact = (double(objs[first[0]].radius) + double(objs[first[1]].radius)) * Units::length;
+        if (Pericentre(r, u, scale * G * total) > contact && KeplerDrift(r, u, scale * G * total, dt)) {
+            x[0] = -r * (m[1] / total);
+            x[1] = r * (m[0] / total);
+            v[0] = -u * (m[1] / total);
+            v[1] = u * (m[0] / total);
+            done = true;
+        }
+    }
+    if (!done) {
+        auto accelerate = [&]() {
+            double tau = std::numeric_limits<double>::max();
+            for (size_t p = 0; p < k; ++p) a[p] = glm::dvec3(0.0);
+            for (size_t p = 0; p < k; ++p) {
+                for (size_t q = p + 1; q < k; ++q) {
+                    glm::dvec3 d = x[q] - x[p], dv = v[q] - v[p];
+                    a[p] += Law::Accel(d, dv, scale * G * m[q], epsM);
+                    a[q] += Law::Accel(-d, -dv, scale * G * m[p], epsM);
+                    double r2 = glm::dot(d, d);
+                    double mu = G * (m[p] + m[q]);
+                    tau = std::min(tau, std::sqrt(r2 * std::sqrt(r2) / mu));
+                    double u2 = glm::dot(dv, dv);
+                    if (u2 > 0.0) tau = std::min(tau, std::sqrt(r2 / u2));
+                }
+            }
+            return tau;
+        };
+        double t = 0.0;
+        double tau = accelerate();
+        for (int sub = 0; t < dt && sub < maxEncounterSubsteps; ++sub) {
+            double h = sub + 1 == maxEncounterSubsteps ? dt - t : std::min(dt - t, encounterAccuracy * tau);
+            for (size_t q = 0; q < k; ++q) {
+                v[q] += a[q] * (0.5 * h);
+                x[q] += v[q] * h;
+            }
+            tau = accelerate();
+            for (size_t q = 0; q < k; ++q) v[q] += a[q] * (0.5 * h);
+            t += h;
+        }
+    }
+
+    glm::dvec3 moved = com + comV * dt;
+    for (size_t q = 0; q < k; ++q) {
+        Object& obj = objs[first[q]];
+        obj.position = glm::vec3((moved + x[q]) / Units::length);
+        obj.velocity = glm::vec3((comV + v[q]) / Units::velocity);
+    }
+    // back half a kick of the internal pulls at the new positions
+    for (size_t p = 0; p < k; ++p) {
+        Object& obj = objs[first[p]];
+        glm::dvec3 pp = glm::dvec3(obj.position) * Units::length;
+        glm::dvec3 vp = glm::dvec3(obj.velocity) * Units::velocity;
+        glm::dvec3 pull(0.0);
+        for (size_t q = 0; q < k; ++q) {
+            const Object& other = objs[first[q]];
+            glm::dvec3 d = glm::dvec3(other.position) * Units::length - pp;
+            if (q == p || (d.x == 0.0 && d.y == 0.0 && d.z == 0.0)) continue;
+            pull += Law::Accel(d, glm::dvec3(other.velocity) * Units::velocity - vp, G * other.mass, epsM);
+        }
+        obj.accelerate(-0.5 * pull.x, -0.5 * pull.y, -0.5 * pull.z, Units::kick * stepScale);
+    }
+}
+
+// one physics step (forces, kick, collisions, drift) specialised per force law and unit system,
+// Compensated switches the per-body sum to Kahan summation for the deterministic mode.
+// When diag is set the start-of-step energy and momenta are written to it.
+template<class Units>
+void KickKernel(std::vector<Object>& objs, const std::vector<glm::dvec3>& acc){
+    for (size_t i = 0; i < objs.size(); ++i) {
+        if (objs[i].Initalizing) continue;
+        objs[i].accelerate(acc[i].x, acc[i].y, acc[i].z, Units::kick * stepScale);
+
+        //collision
+        for (size_t j = 0; j < objs.size(); ++j) {
+            if (j != i && !objs[j].Initalizing) objs[i].velocity *= objs[i].CheckCollision(objs[j]);
+        }
+    }
+}
+template<class Units>
+void IntegrateKernel(std::vector<Object>& objs, const std::vector<glm::dvec3>& acc){
+    KickKernel<Units>(objs, acc);
+    for (auto& obj : objs) {
+        obj.UpdatePos(Units::drift * stepScale);
+    }
+}
+
+template<class Law, class Units, bool Compensated>
+void StepKernel(std::vector<Object>& objs, std::vector<glm::dvec3>& acc, double eps, Diagnostics* diag){
+    const double epsM = eps * Units::length;
+    acc.assign(objs.size(), glm::dvec3(0.0));
+    if (diag) {
+        MeasureDiagnostics<Units>(objs, *diag);
+        diag->potential = AccumulateForces<Law, Units, Compensated, true, true>(objs, objs, acc, epsM);
+    } else {
+        AccumulateForces<Law, Units, Compensated, false, true>(objs, objs, acc, epsM);
+    }
+    if (!encounters) {
+        IntegrateKernel<Units>(objs, acc);
+        return;
+    }
+    static thread_local EncounterGroups groups;
+    FindEncounters<Law, Units>(objs, acc, epsM, groups);
+    KickKernel<Units>(objs, acc);
+    for (size_t i = 0; i < objs.size(); ++i) {
+        if (groups.group[i] < 0) objs[i].UpdatePos(Units::drift * stepScale);
+    }
+    for (size_t g = 0; g < groups.Count(); ++g) DriftEncounterGroup<Law, Units>(objs, groups, g, epsM);
+}
+
+// hybrid Kepler mode, in the spirit of Wisdom-Holman: every body that is bound to the body
+// pulling hardest on it, lighter than it and only weakly perturbed (the rest of its relative
+// acceleration below keplerTolerance of the two-body pull) becomes a satellite of that host.
+// The kick then carries only the perturbation of each satellite's orbit and the drift moves it
+// along the exact two-body orbit around its host (KeplerDrift), so the step can be far longer
+// than the orbit needs under plain leapfrog. Hosts are always heavier than their satellites, so
+// going through the bodies heaviest first handles every host before its satellites (moon around
+// planet around star). Everything else steps exactly as in StepKernel.
+template<class Law, class Units, bool Compensated>
+void KeplerStepKernel(std::vector<Object>& objs, std::vector<glm::dvec3>& acc, double eps, Diagnostics* diag){
+    const double epsM = eps * Units::length;
+    const size_t n = objs.size();
+    acc.assign(n, glm::dvec3(0.0));
+    if (diag) {
+        MeasureDiagnostics<Units>(objs, *diag);
+        diag->potential = AccumulateForces<Law, Units, Compensated, true, true>(objs, objs, acc, epsM);
+    } else {
+        AccumulateForces<Law, Units, Compensated, false, true>(objs, objs, acc, epsM);
+    }
+
+    // per thread so sweep runs can use this kernel concurrently
+    static thread_local std::vector<size_t> host, heaviest;
+    static thread_local std::vector<glm::dvec3> kick;
+    static thread_local std::vector<glm::vec3> oldPosition, kickedVelocity;
+    host.assign(n, SIZE_MAX);
+    heaviest.resize(n);
+    oldPosition.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        heaviest[i] = i;
+        oldPosition[i] = objs[i].position;
+    }
+    std::sort(heaviest.begin(), heaviest.end(), [&](size_t a, size_t b) {
+        return objs[a].mass != objs[b].mass ? objs[a].mass > objs[b].mass : a < b;
+    });
+    // close encounters are taken out first, their bodies neither host nor orbit
+    static thread_local EncounterGroups groups;
+    if (encounters) FindEncounters<Law, Units>(objs, acc, epsM, groups);
+    else groups.group.assign(n, -1);
+    kick.assign(acc.begin(), acc.end());
+
+    // satellites kick with host kick + perturbation, so relative velocities see only the perturbation
+    for (size_t i : heaviest) {
+        if (objs[i].Initalizing || groups.group[i] >= 0) continue;
+        size_t h = DominantAttractor(objs, i);
+        if (h == SIZE_MAX || objs[h].mass <= objs[i].mass || groups.group[h] >= 0) continue;
+        glm::dvec3 r = (glm::dvec3(objs[i].position) - glm::dvec3(objs[h].position)) * Units::length;
+        glm::dvec3 v = (glm::dvec3(objs[i].velocity) - glm::dvec3(objs[h].velocity)) * Units::velocity;
+        double mu = G * (double(objs[i].mass) + double(objs[h].mass));
+        double d = glm::length(r);
+        if (0.5 * glm::dot(v, v) - mu / d >= 0.0) continue;
+        // an orbit through the host's surface is a collision, left to the kick
+        if (Pericentre(r, v, mu) <= (double(objs[i].radius) + double(objs[h].radius)) * Units::length) continue;
+        glm::dvec3 perturbation = acc[i] - acc[h] + r * (mu / (d * d * d));
+        if (glm::length(perturbation) >= keplerTolerance * mu / (d * d)) continue;
+        host[i] = h;
+        kick[i] = kick[h] + perturbation;
+    }
+    KickKernel<Units>(objs, kick);
+    kickedVelocity.resize(n);
+    for (size_t i = 0; i < n; ++i) kickedVelocity[i] = objs[i].velocity;
+
+    // the tuned kick and drift imply slightly different step lengths (SimUnits::velocity is
+    // rounded); the orbit has to bend as much as the kick that was taken out of it would have
+    const double dt = DriftSeconds<Units>();
+    const double muScale = KickScale<Units>();
+    for (size_t i : heaviest) {
+        Object& obj = objs[i];
+        if (groups.group[i] >= 0) continue;
+        size_t h = host[i];
+        glm::dvec3 r, v;
+        if (h != SIZE_MAX) {
+            r = (glm::dvec3(oldPosition[i]) - glm::dvec3(oldPosition[h])) * Units::length;
+            v = (glm::dvec3(kickedVelocity[i]) - glm::dvec3(kickedVelocity[h])) * Units::velocity;
+        }
+        if (h == SIZE_MAX || !KeplerDrift(r, v, muScale * G * (double(obj.mass) + double(objs[h].mass)), dt)) {
+            obj.UpdatePos(Units::drift * stepScale);
+            continue;
+        }
+        // the host has already moved, relative to its state after the drift
+        obj.position = objs[h].position + glm::vec3(r / Units::length);
+        obj.velocity = objs[h].velocity + glm::vec3(v / Units::velocity);
+    }
+    for (size_t g = 0; g < groups.Count(); ++g) DriftEncounterGroup<Law, Units>(objs, groups, g, epsM);
+}
+
+// level-of-detail physics (--lod): a far-away, tightly bound group is integrated as one
+// composite body. Candidates are friends-of-friends groups of the free bodies (linked closer
+// than lodLink world units, at least lodMinBodies of them) that are bound and look small both
+// from the camera and from every body outside them, radius < lodTheta * distance. A composite
+// carries the group's mass, centre of mass and quadrupole (the dipole vanishes about the centre
+// of mass), so the rest of the system feels it to second order, and it moves under their pull
+// plus the reaction to its quadrupole. Its members keep their offsets and internal velocities
+// and ride along rigidly, still drawn as themselves: the group's own evolution pauses while it
+// is far away and resumes when it is expanded again, once the camera or an outside body is
+// within half the forming distance (the margin keeps a group at the threshold from flickering).
+struct Composite {
+    glm::dvec3 position, velocity;  // centre of mass, world units
+    double mass;
+    double quadrupole[6];           // traceless, SI (kg m^2): xx yy zz xy xz yz
+    float radius;                   // outermost member surface from the centre, world units
+    glm::vec3 shift, kick;          // this step's move, handed on to the members
+};
+std::vector<Composite> composites;
+
+// outside pull of a quadrupole on a body at x (SI) from its centre, on top of the monopole
+glm::dvec3 QuadrupoleAccel(const double* q, const glm::dvec3& x){
+    glm::dvec3 qx(q[0] * x.x + q[3] * x.y + q[4] * x.z,
+                  q[3] * x.x + q[1] * x.y + q[5] * x.z,
+                  q[4] * x.x + q[5] * x.y + q[2] * x.z);
+    double r2 = glm::dot(x, x);
+    double r5 = r2 * r2 * std::sqrt(r2);
+    return G * (qx - 2.5 * glm::dot(x, qx) / r2 * x) / r5;
+}
+
+// composites the camera or an outside body has come too close to go back to their members
+void ExpandComposites(std::vector<Object>& objs){
+    auto tooClose = [](const Composite& c, glm::dvec3 p, float clearance) {
+        return c.radius > 2.0f * lodTheta * (float(glm::length(p - c.position)) - c.radius - clearance);
+    };
+    for (size_t c = composites.size(); c-- > 0;) {
+        bool expand = tooClose(composites[c], glm::dvec3(cameraPos), 0.0f);
+        for (size_t i = 0; i < objs.size() && !expand; ++i) {
+            if (objs[i].composite < 0) expand = tooClose(composites[c], glm::dvec3(objs[i].position), objs[i].radius);
+        }
+        for (size_t d = 0; d < composites.size() && !expand; ++d) {
+            if (d != c) expand = tooClose(composites[c], composites[d].position, composites[d].radius);
+        }
+        if (!expand) continue;
+        // the last composite moves into the hole
+        size_t last = composites.size() - 1;
+        for (auto& obj : objs) {
+            if (obj.composite == int32_t(c)) obj.composite = -1;
+            else if (obj.composite == int32_t(last)) obj.composite = int32_t(c);
+        }
+        composites[c] = composites[last];
+        composites.pop_back();
+    }
+}
+
+template<class Units>
+void FormComposites(std::vector<Object>& objs){
+    static thread_local std::vector<std::pair<uint64_t, uint32_t>> cells, groups;
+    static thread_local std::vector<uint32_t> parent;
+    const size_t n = objs.size();
+    // sized for every body up front, so a group breaking up later does not allocate
+    composites.reserve(n / size_t(lodMinBodies) + 1);
+    cells.reserve(n);
+    groups.reserve(n);
+
+    // friends of friends: bodies in cells of lodLink, each linked to its neighbours in the 27 cells around it
+    auto cellOf = [](float x) {
+        return int64_t(std::floor(x / lodLink));
+    };
+    auto cellKey = [](int64_t x, int64_t y, int64_t z) {
+        return uint64_t(x & 0x1fffff) | uint64_t(y & 0x1fffff) << 21 | uint64_t(z & 0x1fffff) << 42;
+    };
+    cells.clear();
+    parent.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        parent[i] = uint32_t(i);
+        if (objs[i].composite < 0 && !objs[i].Initalizing) {
+            const glm::vec3& p = objs[i].position;
+            cells.push_back({ cellKey(cellOf(p.x), cellOf(p.y), cellOf(p.z)), uint32_t(i) });
+        }
+    }
+    std::sort(cells.begin(), cells.end());
+    auto find = [](uint32_t i) {
+        while (parent[i] != i) i = parent[i] = parent[parent[i]];
+        return i;
+    };
+    for (const auto& cell : cells) {
+        uint32_t i = cell.second;
+        const glm::vec3& p = objs[i].position;
+        for (int dx = -1; dx <= 1; ++dx) for (int dy = -1; dy <= 1; ++dy) for (int dz = -1; dz <= 1; ++dz) {
+            uint64_t key = cellKey(cellOf(p.x) + dx, cellOf(p.y) + dy, cellOf(p.z) + dz);
+            auto first = std::lower_bound(cells.begin(), cells.end(), std::make_pair(key, uint32_t(0)));
+            for (auto it = first; it != cells.end() && it->first == key; ++it) {
+                uint32_t j = it->second;
+                glm::vec3 d = objs[j].position - objs[i].position;
+                if (j > i && glm::dot(d, d) < lodLink * lodLink) parent[find(j)] = find(i);
+            }
+        }
+    }
+    groups.clear();
+    for (const auto& cell : cells) groups.push_back({ find(cell.second), cell.second });
+    std::sort(groups.begin(), groups.end());
+
+    for (size_t start = 0, end = 0; start < groups.size(); start = end) {
+        while (end < groups.size() && groups[end].first == groups[start].first) ++end;
+        if (end - start < size_t(lodMinBodies)) continue;
+        Composite c{};
+        for (size_t k = start; k < end; ++k) {
+            const Object& obj = objs[groups[k].second];
+            c.mass += obj.mass;
+            c.position += glm::dvec3(obj.position) * double(obj.mass);
+            c.velocity += glm::dvec3(obj.velocity) * double(obj.mass);
+        }
+        if (c.mass <= 0.0) continue;
+        c.position /= c.mass;
+        c.velocity /= c.mass;
+        for (size_t k = start; k < end; ++k) {
+            const Object& obj = objs[groups[k].second];
+            c.radius = std::max(c.radius, float(glm::length(glm::dvec3(obj.position) - c.position)) + obj.radius);
+        }
+        // cheapest test first, the O(k^2) binding energy last
+        if (c.radius >= lodTheta * (float(glm::length(glm::dvec3(cameraPos) - c.position)) - c.radius)) continue;
+        int32_t tag = int32_t(composites.size());
+        for (size_t k = start; k < end; ++k) objs[groups[k].second].composite = tag;
+        bool isolated = true;
+        for (size_t i = 0; i < n && isolated; ++i) {
+            if (objs[i].composite == tag || objs[i].Initalizing) continue;
+            float gap = float(glm::length(glm::dvec3(objs[i].position) - c.position)) - c.radius - objs[i].radius;
+            isolated = c.radius < lodTheta * gap;
+        }
+        double energy = 0.0;
+        for (size_t k = start; k < end && isolated; ++k) {
+            const Object& a = objs[groups[k].second];
+            glm::dvec3 v = (glm::dvec3(a.velocity) - c.velocity) * Units::velocity;
+            energy += 0.5 * a.mass * glm::dot(v, v);
+            for (size_t l = k + 1; l < end; ++l) {
+                const Object& b = objs[groups[l].second];
+                double r = glm::length(glm::dvec3(b.position) - glm::dvec3(a.position)) * Units::length;
+                if (r > 0.0) energy -= G * double(a.mass) * double(b.mass) / r;
+            }
+        }
+        if (!isolated || energy >= 0.0) {
+            for (size_t k = start; k < end; ++k) objs[groups[k].second].composite = -1;
+            continue;
+        }
+        for (size_t k = start; k < end; ++k) {
+            const Object& obj = objs[groups[k].second];
+            glm::dvec3 y = (glm::dvec3(obj.position) - c.position) * Units::length;
+            double m = obj.mass, y2 = glm::dot(y, y);
+            c.quadrupole[0] += m * (3.0 * y.x * y.x - y2);
+            c.quadrupole[1] += m * (3.0 * y.y * y.y - y2);
+            c.quadrupole[2] += m * (3.0 * y.z * y.z - y2);
+            c.quadrupole[3] += m * 3.0 * y.x * y.y;
+            c.quadrupole[4] += m * 3.0 * y.x * y.z;
+            c.quadrupole[5] += m * 3.0 * y.y * y.z;
+        }
+        composites.push_back(c);
+    }
+}
+
+// leapfrog like IntegrateKernel over the free bodies and the composites; members only follow.
+// Compensated sums and the Kepler and encounter paths are left to the full-resolution kernels,
+// the diagnostics still sum every pair (exactly, on sample steps only).
+template<class Law, class Units>
+void LodStepKernel(std::vector<Object>& objs, std::vector<glm::dvec3>& acc, double eps, Diagnostics* diag){
+    const double epsM = eps * Units::length;
+    const size_t n = objs.size();
+    acc.assign(n, glm::dvec3(0.0));
+    if (diag) {
+        MeasureDiagnostics<Units>(objs, *diag);
+        diag->potential = AccumulateForces<Law, Units, false, true, true>(objs, objs, acc, epsM);
+        acc.assign(n, glm::dvec3(0.0));
+    }
+    ExpandComposites(objs);
+    if (simStep % uint64_t(lodInterval) == 0) FormComposites<Units>(objs);
+
+    static thread_local std::vector<uint32_t> loose;
+    static thread_local std::vector<glm::dvec3> compositeAcc;
+    loose.clear();
+    loose.reserve(n);
+    compositeAcc.reserve(n / size_t(lodMinBodies) + 1);
+    for (size_t i = 0; i < n; ++i) {
+        if (objs[i].composite < 0 && !objs[i].Initalizing) loose.push_back(uint32_t(i));
+    }
+    const size_t m = composites.size();
+    compositeAcc.assign(m, glm::dvec3(0.0));
+    for (uint32_t i : loose) {
+        glm::dvec3 pi = glm::dvec3(objs[i].position) * Units::length;
+        glm::dvec3 vi = glm::dvec3(objs[i].velocity) * Units::velocity;
+        for (uint32_t j : loose) {
+            glm::dvec3 d = glm::dvec3(objs[j].position) * Units::length - pi;
+            if (j == i || (d.x == 0.0 && d.y == 0.0 && d.z == 0.0)) continue;
+            acc[i] += Law::Accel(d, glm::dvec3(objs[j].velocity) * Units::velocity - vi, G * objs[j].mass, epsM);
+        }
+        for (size_t c = 0; c < m; ++c) {
+            const Composite& comp = composites[c];
+            glm::dvec3 d = comp.position * Units::length - pi;
+            glm::dvec3 dv = comp.velocity * Units::velocity - vi;
+            glm::dvec3 tidal = QuadrupoleAccel(comp.quadrupole, -d);
+            acc[i] += Law::Accel(d, dv, G * comp.mass, epsM) + tidal;
+            compositeAcc[c] += Law::Accel(-d, -dv, G * objs[i].mass, epsM) - tidal * (double(objs[i].mass) / comp.mass);
+        }
+    }
+    for (size_t c = 0; c < m; ++c) {
+        for (size_t e = 0; e < m; ++e) {
+            if (e == c) continue;
+            glm::dvec3 d = (composites[e].position - composites[c].position) * Units::length;
+            glm::dvec3 dv = (composites[e].velocity - composites[c].velocity) * Units::velocity;
+            // e's pull with its quadrupole, and the reaction to c's quadrupole
+            compositeAcc[c] += Law::Accel(d, dv, G * composites[e].mass, epsM) + QuadrupoleAccel(composites[e].quadrupole, -d)
+                             - QuadrupoleAccel(composites[c].quadrupole, d) * (composites[e].mass / composites[c].mass);
+        }
+    }
+
+    const float kick = float(Units::kick * stepScale);
+    const float drift = float(Units::drift * stepScale);
+    for (uint32_t i : loose) {
+        objs[i].accelerate(acc[i].x, acc[i].y, acc[i].z, kick);
+        for (uint32_t j : loose) {
+            if (j != i) objs[i].velocity *= objs[i].CheckCollision(objs[j]);
+        }
+    }
+    for (size_t c = 0; c < m; ++c) {
+        Composite& comp = composites[c];
+        comp.kick = glm::vec3(compositeAcc[c] * double(kick));
+        comp.velocity += glm::dvec3(comp.kick);
+        comp.shift = glm::vec3(comp.velocity * double(drift));
+        comp.position += glm::dvec3(comp.shift);
+    }
+    for (auto& obj : objs) {
+        if (obj.composite < 0) {
+            obj.UpdatePos(drift);
+            continue;
+        }
+        const Composite& comp = composites[obj.composite];
+        obj.velocity += comp.kick;
+        obj.position += comp.shift;
+    }
+}
+
+typedef void (*StepFn)(std::vector<Object>&, std::vector<glm::dvec3>&, double, Diagnostics*);
+
+template<class Units, bool Compensated>
+StepFn SelectStepKernel(ForceLaw law, bool kepler, bool lod){
+    switch (law) {
+        case ForceLaw::Plummer:       return lod ? LodStepKernel<PlummerSoftened, Units> : kepler ? KeplerStepKernel<PlummerSoftened, Units, Compensated> : StepKernel<PlummerSoftened, Units, Compensated>;
+        case ForceLaw::Spline:        return lod ? LodStepKernel<SplineSoftened, Units> : kepler ? KeplerStepKernel<SplineSoftened, Units, Compensated> : StepKernel<SplineSoftened, Units, Compensated>;
+        case ForceLaw::PostNewtonian: return lod ? LodStepKernel<PostNewtonian, Units> : kepler ? KeplerStepKernel<PostNewtonian, Units, Compensated> : StepKernel<PostNewtonian, Units, Compensated>;
+        default:                      return lod ? LodStepKernel<Newtonian, Units> : kepler ? KeplerStepKernel<Newtonian, Units, Compensated> : StepKernel<Newtonian, Units, Compensated>;
+    }
+}
+// resolved once per scenario / key press, never inside the pair loop
+StepFn SelectStepKernel(ForceLaw law, UnitSystem units, bool compensated = false, bool kepler = false, bool lod = false){
+    if (units == UnitSystem::SI) {
+        return compensated ? SelectStepKernel<SIUnits, true>(law, kepler, lod) : SelectStepKernel<SIUnits, false>(law, kepler, lod);
+    }
+    return compensated ? SelectStepKernel<SimUnits, true>(law, kepler, lod) : SelectStepKernel<SimUnits, false>(law, kepler, lod);
+}
+StepFn stepKernel = SelectStepKernel(forceLaw, unitSystem);
+std::vector<glm::dvec3> accScratch;
+
+// live metrics (--metrics PORT): the loop publishes into relaxed atomics (one writer, plain
+// loads and stores, no locks) and MetricsServer answers scrapes from its own thread. Stage times
+// are taken on one step in sampleEvery and counted sampleEvery-fold, so even a step of a few
+// hundred nanoseconds does not notice the clock; without --metrics it is one branch per stage.
+struct Metrics {
+    enum Stage { Emit, Kernel, Sort, Trajectory, Render, StageCount };
+    static constexpr uint64_t sampleEvery = 16;
+
+    bool enabled = false;
+    std::atomic<uint64_t> steps{ 0 };
+    std::atomic<uint64_t> bodies{ 0 };
+    std::atomic<uint64_t> frames{ 0 };
+    std::atomic<uint64_t> stageNanos[StageCount] = {};
+    std::atomic<double> energyError{ 0.0 };
+
+    static uint64_t Now() {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+    // 0 = this one is not timed, every Lap after it is free
+    uint64_t Start(bool timed) const {
+        return enabled && timed ? Now() : 0;
+    }
+    // charge the time since `since` to the stage, returns the start of the next stage
+    uint64_t Lap(Stage stage, uint64_t since, uint64_t weight) {
+        if (since == 0) return 0;
+        uint64_t now = Now();
+        Add(stageNanos[stage], (now - since) * weight);
+        return now;
+    }
+    static void Add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+Metrics metrics;
+
+// Prometheus text exposition on 127.0.0.1, any path. One connection at a time is plenty for a
+// local scraper; the thread wakes every 200 ms to see whether it should stop.
+class MetricsServer {
+    public:
+#ifndef _WIN32
+        // <unistd.h> would bring close() along with a pause() that clashes with ours
+        static void CloseSocket(int fd) {
+            if (FILE* stream = fdopen(fd, "r+")) fclose(stream);
+        }
+#endif
+        ~MetricsServer() {
+            Stop();
+        }
+
+        bool Start(int port) {
+#ifdef _WIN32
+            std::cerr << "--metrics needs POSIX sockets." << std::endl;
+            return false;
+#else
+            listener = socket(AF_INET, SOCK_STREAM, 0);
+            int on = 1;
+            setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(uint16_t(port));
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 8) < 0) {
+                std::cerr << "Failed to serve metrics on 127.0.0.1:" << port << std::endl;
+                if (listener >= 0) CloseSocket(listener);
+                listener = -1;
+                return false;
+            }
+            metrics.enabled = true;
+            started = lastScrape = Metrics::Now();
+            worker = std::thread([this] { Serve(); });
+            std::cout << "metrics on http://127.0.0.1:" << port << "/metrics" << std::endl;
+            return true;
+#endif
+        }
+        void Stop() {
+            if (!worker.joinable()) return;
+            stopping = true;
+            worker.join();
+#ifndef _WIN32
+            CloseSocket(listener);
+#endif
+        }
+
+    private:
+        int listener = -1;
+        std::thread worker;
+        std::atomic<bool> stopping{ false };
+        uint64_t started = 0, lastScrape = 0, lastSteps = 0;   // server thread only
+
+        void Serve() {
+#ifndef _WIN32
+            while (!stopping) {
+                pollfd waiting{ listener, POLLIN, 0 };
+                if (poll(&waiting, 1, 200) <= 0) continue;
+                int client = accept(listener, nullptr, nullptr);
+                if (client < 0) continue;
+                // the request itself does not matter, but a scraper expects it to be read
+                timeval timeout{ 1, 0 };
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                char request[2048];
+                if (recv(client, request, sizeof(request), 0) > 0) {
+                    std::string body = Render();
+                    std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                                         + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+                    for (size_t sent = 0; sent < response.size();) {
+                        ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                        if (n <= 0) break;
+                        sent += size_t(n);
+                    }
+                }
+                CloseSocket(client);
+            }
+#endif
+        }
+
+        std::string Render() {
+            static const char* stageNames[Metrics::StageCount] = { "emit", "kernel", "sort", "trajectory", "render" };
+            uint64_t now = Metrics::Now();
+            uint64_t steps = metrics.steps.load(std::memory_order_relaxed);
+            double rate = now > lastScrape ? double(steps - lastSteps) * 1e9 / double(now - lastScrape) : 0.0;
+            lastScrape = now;
+            lastSteps = steps;
+
+            std::ostringstream out;
+            out << std::setprecision(10);
+            auto metric = [&out](const char* name, const char* type, const char* help) {
+                out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+            };
+            metric("gravity_sim_steps_total", "counter", "Physics steps taken.");
+            out << "gravity_sim_steps_total " << steps << "\n";
+            metric("gravity_sim_steps_per_second", "gauge", "Step rate since the previous scrape.");
+            out << "gravity_sim_steps_per_second " << rate << "\n";
+            metric("gravity_sim_bodies", "gauge", "Bodies in the scene.");
+            out << "gravity_sim_bodies " << metrics.bodies.load(std::memory_order_relaxed) << "\n";
+            metric("gravity_sim_frames_total", "counter", "Frames drawn.");
+            out << "gravity_sim_frames_total " << metrics.frames.load(std::memory_order_relaxed) << "\n";
+            metric("gravity_sim_stage_seconds_total", "counter", "Time spent per stage of the step and frame loop (steps sampled 1 in 16).");
+            for (int stage = 0; stage < Metrics::StageCount; ++stage) {
+                out << "gravity_sim_stage_seconds_total{stage=\"" << stageNames[stage] << "\"} "
+                    << double(metrics.stageNanos[stage].load(std::memory_order_relaxed)) * 1e-9 << "\n";
+            }
+            metric("gravity_sim_energy_error", "gauge", "Relative energy drift (E - E0) / |E0| at the last diagnostics sample.");
+            out << "gravity_sim_energy_error " << metrics.energyError.load(std::memory_order_relaxed) << "\n";
+            metric("gravity_sim_uptime_seconds", "gauge", "Seconds since the metrics server started.");
+            out << "gravity_sim_uptime_seconds " << double(now - started) * 1e-9 << "\n";
+#ifndef _WIN32
+            // Linux only, elsewhere the memory lines are left out
+            std::ifstream status("/proc/self/status");
+            double residentKb = -1.0, virtualKb = -1.0;
+            for (std::string line; std::getline(status, line);) {
+                if (line.compare(0, 6, "VmRSS:") == 0) residentKb = std::stod(line.substr(6));
+                if (line.compare(0, 7, "VmSize:") == 0) virtualKb = std::stod(line.substr(7));
+            }
+            if (residentKb >= 0.0) {
+                metric("process_resident_memory_bytes", "gauge", "Resident memory size in bytes.");
+                out << "process_resident_memory_bytes " << residentKb * 1024.0 << "\n";
+            }
+            if (virtualKb >= 0.0) {
+                metric("process_virtual_memory_bytes", "gauge", "Virtual memory size in bytes.");
+                out << "process_virtual_memory_bytes " << virtualKb * 1024.0 << "\n";
+            }
+#endif
+            return out.str();
+        }
+};
+MetricsServer metricsServer;
+
+// conservation monitor, sampled every diagInterval steps (0 = off)
+int diagInterval = 100;
+Diagnostics diag;
+double initialEnergy = 0.0;
+bool haveInitialEnergy = false;
+std::ostream* telemetry = &std::cout;
+std::ofstream telemetryFile;
+
+void ReportDiagnostics(Diagnostics& d){
+    double energy = d.kinetic + d.potential;
+    if (!haveInitialEnergy) {
+        initialEnergy = energy;
+        haveInitialEnergy = true;
+    }
+    d.energyError = initialEnergy != 0.0 ? (energy - initialEnergy) / std::abs(initialEnergy) : 0.0;
+    metrics.energyError.store(d.energyError, std::memory_order_relaxed);
+    *telemetry<<"diag step="<<d.step
+              <<" KE="<<d.kinetic<<" PE="<<d.potential<<" E="<<energy<<" dE/E0="<<d.energyError
+              <<" P=("<<d.momentum.x<<","<<d.momentum.y<<","<<d.momentum.z<<")"
+              <<" L=("<<d.angularMomentum.x<<","<<d.angularMomentum.y<<","<<d.angularMomentum.z<<")"<<std::endl;
+}
+
+// FNV-1a over the bit patterns of every body's state, so two runs can be diffed step by step
+uint64_t StateHash(const std::vector<Object>& objs){
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&h](const void* data, size_t n) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < n; ++i) {
+            h ^= p[i];
+            h *= 1099511628211ull;
+        }
+    };
+    for (const auto& obj : objs) {
+        mix(&obj.position, sizeof(obj.position));
+        mix(&obj.velocity, sizeof(obj.velocity));
+        mix(&obj.mass, sizeof(obj.mass));
+    }
+    return h;
+}
+
+// trajectory files: a header then one frame every trajectoryInterval steps,
+// each frame a TrajectoryFrame followed by count TrajectoryBody records (see --replay)
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t bodyBytes;
+    uint32_t reserved;
+};
+struct TrajectoryFrame {
+    uint64_t step;
+    uint64_t count;
+};
+struct TrajectoryBody {
+    glm::vec3 position;
+    float mass;
+    float density;
+    glm::vec4 color;
+    uint32_t id;
+    uint32_t glow;
+};
+std::ofstream trajectoryOut;
+int trajectoryInterval = 10;
+
+bool OpenTrajectory(const std::string& path){
+    trajectoryOut.open(path, std::ios::binary);
+    if (!trajectoryOut) {
+        std::cerr << "Failed to open trajectory file " << path << std::endl;
+        return false;
+    }
+    TrajectoryHeader header = { { 'G', 'S', 'I', 'M', 'T', 'R', 'J', '1' }, sizeof(TrajectoryBody), 0 };
+    trajectoryOut.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return true;
+}
+
+void WriteTrajectoryFrame(const std::vector<Object>& objs, uint64_t step){
+    static std::vector<TrajectoryBody> bodies;
+    bodies.clear();
+    for (const auto& obj : objs) {
+        if (obj.Initalizing) continue;
+        bodies.push_back({ obj.position, obj.mass, obj.density, obj.color, obj.id, obj.glow ? 1u : 0u });
+    }
+    TrajectoryFrame frame = { step, bodies.size() };
+    trajectoryOut.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+    trajectoryOut.write(reinterpret_cast<const char*>(bodies.data()), bodies.size() * sizeof(TrajectoryBody));
+}
+
+// continuous source of bodies (a particle stream, an accretion feed): rate bodies per step on
+// average, fractional rates carry over. Positions are jittered around position, velocities are
+// velocity plus a gaussian of speedSpread per axis and masses are log-normal around mass.
+struct Emitter {
+    bool active = false;
+    double rate = 2.0;              // bodies per step
+    glm::vec3 position = glm::vec3(-8000.0f, 650.0f, -350.0f);
+    glm::vec3 velocity = glm::vec3(0.0f, 0.0f, 1200.0f);
+    float positionSpread = 150.0f;  // world units
+    float speedSpread = 60.0f;      // world velocity
+    float mass = 5e21f;
+    float massSigma = 0.5f;         // of ln(mass)
+    uint64_t limit = 0;             // stop after this many bodies, 0 = never
+    uint64_t emitted = 0;
+    double carry = 0.0;
+    std::mt19937_64 rng{ 0x2545f4914f6cdd1dull };
+
+    void Step(BodyRegistry& registry, std::vector<Object>& objs) {
+        carry += rate;
+        uint64_t count = uint64_t(carry);
+        carry -= double(count);
+        if (limit > 0) count = std::min(count, limit - std::min(limit, emitted));
+        if (count == 0) return;
+
+        // one reservation per batch, the bodies themselves need no GPU upload (shared sphere)
+        registry.Reserve(objs.size() + count);
+        std::normal_distribution<float> gauss(0.0f, 1.0f);
+        for (uint64_t i = 0; i < count; ++i) {
+            glm::vec3 p = position + glm::vec3(gauss(rng), gauss(rng), gauss(rng)) * positionSpread;
+            glm::vec3 v = velocity + glm::vec3(gauss(rng), gauss(rng), gauss(rng)) * speedSpread;
+            float m = mass * std::exp(massSigma * gauss(rng));
+            registry.Insert(Object(p, v, m, 5515, glm::vec4(0.6f, 0.8f, 1.0f, 1.0f)));
+        }
+        emitted += count;
+    }
+};
+Emitter emitter;
+
+// optional GPU backend (--gpu-physics, needs OpenGL 4.3): body state lives in shader storage
+// buffers, a step is two compute passes (the tiled N^2 kick with the collision bounce, then the
+// drift) and DrawScene instances the sphere mesh straight from the same buffers, so no step
+// reads anything back. objs becomes a mirror: Pull refreshes it where the CPU needs positions
+// (the grid every gpuSyncFrames frames, the inspector, diagnostics, trajectories, the final
+// hash) and Push carries CPU-side edits over (appended bodies, the body being placed, hover
+// colours). Newtonian and Plummer forces only, anything else steps on the CPU kernels.
+bool gpuPhysics = false;
+bool gpuDouble = false;         // double precision forces, slow on most consumer GPUs
+int gpuSyncFrames = 30;
+bool gpuParity = false;         // see RunGpuParity
+double gpuParityTolerance = 1e-3;
+
+class GpuPhysics {
+    public:
+        // once a context is current; false (and the CPU keeps stepping) without compute shaders
+        bool Start() {
+            if (!GLEW_VERSION_4_3) {
+                std::cerr << "GPU physics needs OpenGL 4.3 compute shaders, stepping on the CPU." << std::endl;
+                return false;
+            }
+            doubles = gpuDouble;
+            std::string header = doubles ? "#version 430\n#define real double\n#define realv dvec3\n"
+                                         : "#version 430\n#define real float\n#define realv vec3\n";
+            kickProgram = CreateComputeProgram(header.c_str(), kickComputeShaderSource);
+            driftProgram = CreateComputeProgram(header.c_str(), driftComputeShaderSource);
+            if (kickProgram == 0 || driftProgram == 0) return false;
+            kickCount = glGetUniformLocation(kickProgram, "count");
+            kickG = glGetUniformLocation(kickProgram, "G");
+            kickLength = glGetUniformLocation(kickProgram, "unitLength");
+            kickEps2 = glGetUniformLocation(kickProgram, "eps2");
+            kickScale = glGetUniformLocation(kickProgram, "kick");
+            driftCount = glGetUniformLocation(driftProgram, "count");
+            driftScale = glGetUniformLocation(driftProgram, "drift");
+            return true;
+        }
+        bool Ready() const {
+            return kickProgram != 0 && driftProgram != 0;
+        }
+
+        // one kick-drift step, after carrying over whatever the CPU changed
+        void Step(std::vector<Object>& objs) {
+            Push(objs);
+            if (count == 0) return;
+            if (unitSystem == UnitSystem::SI) {
+                Dispatch<SIUnits>();
+            } else {
+                Dispatch<SimUnits>();
+            }
+            ahead = true;
+        }
+
+        // bodies appended, removed or re-sorted on the CPU, and every body the CPU owns
+        // (Initalizing) or has recoloured, go over to the buffers; the rest stay as they are
+        void Push(std::vector<Object>& objs) {
+            size_t n = objs.size();
+            size_t kept = std::min(n, count);
+            for (size_t i = 0; i < kept; ++i) {
+                if (ids[i] == objs[i].id) continue;
+                // order changed: take the GPU state over by id, then send everything
+                Pull(objs);
+                kept = 0;
+            }
+            if (n > capacity) Grow(n, kept);
+            ids.resize(n);
+            flags.resize(n);
+            for (size_t i = 0; i < kept; ++i) {
+                uint8_t f = Flags(objs[i]);
+                if (objs[i].Initalizing || ((f ^ flags[i]) & 1)) {
+                    Upload(objs, i, i + 1);
+                } else if (f != flags[i]) {
+                    UploadLooks(objs, i, i + 1);
+                }
+            }
+            if (n > kept) Upload(objs, kept, n);
+            count = n;
+        }
+
+        // objs up to date with the buffers; free unless a step ran since the last Pull
+        void Pull(std::vector<Object>& objs) {
+            if (!ahead) return;
+            ahead = false;
+            spheres.resize(count);
+            velocities.resize(count);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec4), spheres.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec4), velocities.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            // bodies uploaded as CPU-owned were never stepped, the CPU copy is the newer one
+            auto apply = [this](Object& obj, size_t k) {
+                if (flags[k] & 1) return;
+                obj.position = glm::vec3(spheres[k]);
+                obj.velocity = glm::vec3(velocities[k]);
+            };
+            size_t kept = std::min(objs.size(), count);
+            size_t i = 0;
+            for (; i < kept && ids[i] == objs[i].id; ++i) apply(objs[i], i);
+            if (i == kept) return;
+            std::unordered_map<uint32_t, size_t> index;
+            for (size_t k = i; k < count; ++k) index[ids[k]] = k;
+            for (; i < objs.size(); ++i) {
+                auto found = index.find(objs[i].id);
+                if (found != index.end()) apply(objs[i], found->second);
+            }
+        }
+        // back to the CPU kernels (force law or mode switched), the next Push starts over from objs
+        void Release(std::vector<Object>& objs) {
+            Pull(objs);
+            count = 0;
+        }
+
+        // conservation sample on the pulled state, the CPU pair loop supplies the potential
+        void Measure(std::vector<Object>& objs, std::vector<glm::dvec3>& acc, Diagnostics& diag) {
+            Pull(objs);
+            if (unitSystem == UnitSystem::SI) {
+                Measure<SIUnits>(objs, acc, diag);
+            } else {
+                Measure<SimUnits>(objs, acc, diag);
+            }
+        }
+
+        // every body as an instance of the unit sphere, read straight from the step buffers
+        void Draw(const glm::mat4& view, const glm::mat4& projection, GLuint sphereVBO, GLsizei sphereVertices) {
+            if (count == 0) return;
+            static GLuint program = CreateShaderProgram(instancedVertexShaderSource, instancedFragmentShaderSource);
+            if (vao == 0) glGenVertexArrays(1, &vao);
+            // Grow replaces the buffers, so the instance attributes are pointed at them every time
+            glBindVertexArray(vao);
+            glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribDivisor(1, 1);
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[3]);
+            glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Look), (void*)offsetof(Look, color));
+            glEnableVertexAttribArray(2);
+            glVertexAttribDivisor(2, 1);
+            glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Look), (void*)offsetof(Look, glow));
+            glEnableVertexAttribArray(3);
+            glVertexAttribDivisor(3, 1);
+            glUseProgram(program);
+            glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+            glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+            glUniform1f(glGetUniformLocation(program, "glowIntensity"), glowIntensity);
+            glDrawArraysInstanced(GL_TRIANGLES, 0, sphereVertices, GLsizei(count));
+            glBindVertexArray(0);
+        }
+
+    private:
+        struct Look {
+            uint8_t color[4];
+            float glow;
+        };
+        GLuint kickProgram = 0, driftProgram = 0, vao = 0;
+        GLuint buffers[4] = { 0, 0, 0, 0 };    // spheres, velocities, sources, looks
+        GLint kickCount = -1, kickG = -1, kickLength = -1, kickEps2 = -1, kickScale = -1;
+        GLint driftCount = -1, driftScale = -1;
+        bool doubles = false;
+        bool ahead = false;                     // steps ran since the last Pull
+        size_t count = 0, capacity = 0;
+        std::vector<uint32_t> ids;              // Object::id per buffer slot, to spot reordering
+        std::vector<uint8_t> flags;             // Flags at upload
+        std::vector<glm::vec4> spheres, velocities;
+        std::vector<glm::vec2> sources;
+        std::vector<Look> looks;
+
+        static uint8_t Flags(const Object& obj) {
+            return uint8_t(obj.Initalizing) | uint8_t(obj.target) << 1;
+        }
+
+        template<class Units>
+        void Dispatch() {
+            GLuint groups = GLuint((count + 63) / 64);
+            for (GLuint b = 0; b < 3; ++b) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, buffers[b]);
+            double epsM = forceLaw == ForceLaw::Plummer ? softening * Units::length : 0.0;
+            glUseProgram(kickProgram);
+            glUniform1ui(kickCount, GLuint(count));
+            SetReal(kickG, G);
+            SetReal(kickLength, Units::length);
+            SetReal(kickEps2, epsM * epsM);
+            glUniform1f(kickScale, float(Units::kick * stepScale));
+            glDispatchCompute(groups, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            glUseProgram(driftProgram);
+            glUniform1ui(driftCount, GLuint(count));
+            glUniform1f(driftScale, float(Units::drift * stepScale));
+            glDispatchCompute(groups, 1, 1);
+            // the next kick, the instanced draw and Pull all read what the drift wrote
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        }
+        void SetReal(GLint location, double value) {
+            if (doubles) {
+                glUniform1d(location, value);
+            } else {
+                glUniform1f(location, float(value));
+            }
+        }
+
+        template<class Units>
+        static void Measure(const std::vector<Object>& objs, std::vector<glm::dvec3>& acc, Diagnostics& diag) {
+            MeasureDiagnostics<Units>(objs, diag);
+            acc.assign(objs.size(), glm::dvec3(0.0));
+            double epsM = softening * Units::length;
+            if (forceLaw == ForceLaw::Plummer) {
+                diag.potential = AccumulateForces<PlummerSoftened, Units, false, true, true>(objs, objs, acc, epsM);
+            } else {
+                diag.potential = AccumulateForces<Newtonian, Units, false, true, true>(objs, objs, acc, epsM);
+            }
+        }
+
+        // geometric growth, the first kept bodies are copied over on the GPU
+        void Grow(size_t n, size_t kept) {
+            size_t grown = std::max(std::max<size_t>(n, 1024), capacity * 2);
+            const size_t strides[4] = { sizeof(glm::vec4), sizeof(glm::vec4), sizeof(glm::vec2), sizeof(Look) };
+            for (int b = 0; b < 4; ++b) {
+                GLuint fresh;
+                glGenBuffers(1, &fresh);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, fresh);
+                glBufferData(GL_COPY_WRITE_BUFFER, grown * strides[b], nullptr, GL_DYNAMIC_DRAW);
+                if (kept > 0) {
+                    glBindBuffer(GL_COPY_READ_BUFFER, buffers[b]);
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, kept * strides[b]);
+                }
+                glDeleteBuffers(1, &buffers[b]);
+                buffers[b] = fresh;
+            }
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            capacity = grown;
+            ids.reserve(grown);
+            flags.reserve(grown);
+        }
+        template<class T>
+        void SubData(GLuint buffer, size_t first, const std::vector<T>& data) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(T), data.size() * sizeof(T), data.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+        void Upload(const std::vector<Object>& objs, size_t first, size_t last) {
+            size_t n = last - first;
+            spheres.resize(n);
+            velocities.resize(n);
+            sources.resize(n);
+            for (size_t k = 0; k < n; ++k) {
+                const Object& obj = objs[first + k];
+                spheres[k] = glm::vec4(obj.position, obj.radius);
+                velocities[k] = glm::vec4(obj.velocity, 0.0f);
+                sources[k] = glm::vec2(obj.mass, obj.Initalizing ? 0.0f : 1.0f);
+            }
+            SubData(buffers[0], first, spheres);
+            SubData(buffers[1], first, velocities);
+            SubData(buffers[2], first, sources);
+            UploadLooks(objs, first, last);
+        }
+        // the hovered body is drawn white, like the CPU path
+        void UploadLooks(const std::vector<Object>& objs, size_t first, size_t last) {
+            looks.resize(last - first);
+            for (size_t k = 0; k < looks.size(); ++k) {
+                const Object& obj = objs[first + k];
+                glm::vec4 color = obj.target ? glm::vec4(1.0f) : obj.color;
+                for (int c = 0; c < 4; ++c) looks[k].color[c] = uint8_t(glm::clamp(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+                looks[k].glow = obj.glow ? 1.0f : 0.0f;
+                ids[first + k] = obj.id;
+                flags[first + k] = Flags(obj);
+            }
+            SubData(buffers[3], first, looks);
+        }
+};
+GpuPhysics gpu;
+
+// the compute passes implement IntegrateKernel with Newtonian or Plummer forces and no more
+bool GpuStepping(){
+    return gpuPhysics && gpu.Ready() && !deterministic && !keplerMode && !encounters && !lodPhysics
+        && (forceLaw == ForceLaw::Newtonian || forceLaw == ForceLaw::Plummer);
+}
+
+void StepPhysics(std::vector<Object>& objs){
+#ifndef NDEBUG
+    // steady state = the same bodies for a full cycle of every periodic task, by then
+    // accScratch, frameArena and the static buffers have all reached their high-water mark
+    static size_t lastCount = size_t(-1);
+    static uint64_t steadySteps = 0;
+    steadySteps = objs.size() == lastCount ? steadySteps + 1 : 0;
+    lastCount = objs.size();
+    uint64_t allocationsBefore = heapAllocations;
+#endif
+    frameArena.Reset();
+    uint64_t lap = metrics.Start(simStep % Metrics::sampleEvery == 0);
+    if (emitter.active) emitter.Step(registry, objs);
+    lap = metrics.Lap(Metrics::Emit, lap, Metrics::sampleEvery);
+    bool sample = diagInterval > 0 && simStep % diagInterval == 0;
+    bool onGpu = GpuStepping();
+    if (onGpu) {
+        if (sample) gpu.Measure(objs, accScratch, diag);
+        gpu.Step(objs);
+    } else {
+        gpu.Release(objs);
+        stepKernel(objs, accScratch, softening, sample ? &diag : nullptr);
+    }
+    if (sample) {
+        diag.step = simStep;
+        ReportDiagnostics(diag);
+    }
+    ++simStep;
+    lap = metrics.Lap(Metrics::Kernel, lap, Metrics::sampleEvery);
+    // the GPU pair loop does not care about memory order
+    if (sortInterval > 0 && simStep % sortInterval == 0 && !onGpu) {
+        SortByMorton(objs);
+    }
+    lap = metrics.Lap(Metrics::Sort, lap, Metrics::sampleEvery);
+    if (trajectoryOut.is_open() && simStep % trajectoryInterval == 0) {
+        gpu.Pull(objs);
+        WriteTrajectoryFrame(objs, simStep);
+    }
+    metrics.Lap(Metrics::Trajectory, lap, Metrics::sampleEvery);
+    metrics.steps.store(simStep, std::memory_order_relaxed);
+    metrics.bodies.store(objs.size(), std::memory_order_relaxed);
+    if (deterministic && simStep % hashInterval == 0) {
+        std::cout<<"step "<<simStep<<" hash "<<std::hex<<std::setw(16)<<std::setfill('0')<<StateHash(objs)<<std::dec<<std::endl;
+    }
+#ifndef NDEBUG
+    int cycle = std::max(std::max(diagInterval, sortInterval), std::max(trajectoryInterval, hashInterval));
+    if (lodPhysics) cycle = std::max(cycle, lodInterval);
+    // reported once rather than asserted, a scratch buffer that still grows is a slowdown, not a bug
+    static bool reported = false;
+    if (steadySteps > uint64_t(cycle) && heapAllocations != allocationsBefore && !reported) {
+        std::cerr<<"warning: "<<heapAllocations - allocationsBefore<<" heap allocations in steady-state step "<<simStep<<std::endl;
+        reported = true;
+    }
+#endif
+}
+
+// time warp: physics steps per rendered frame (- and = halve and double it, 0 resets). The steps
+// run back to back and only the last state is drawn, so the grid and meshes are built once per
+// frame whatever the warp. Outside deterministic mode a batch that has used warpBudget seconds
+// is cut short, the window stays responsive when K is more than the machine can keep up with.
+const int maxWarpSteps = 8192;
+int warpSteps = 1;
+double warpBudget = 0.05;
+
+// fixed physics rate: with --physics-rate HZ the steps follow real time instead of the frame
+// rate, warpSteps of them every 1/HZ seconds through an accumulator, and each frame is drawn
+// renderAlpha of the way from the state before the last step to the last one (the leftover
+// fraction of a step, see InterpolatePositions). Physics can then run well under the monitor
+// rate and still move smoothly, at the price of drawing up to one step behind.
+double physicsRate = 0.0;       // steps per second, 0 = warpSteps per frame
+bool interpolation = true;
+double physicsAccumulator = 0.0;
+float renderAlpha = 1.0f;
+
+void StepWarp(std::vector<Object>& objs){
+    double start = glfwGetTime();
+    int steps = warpSteps;
+    if (physicsRate > 0.0) {
+        physicsAccumulator += deltaTime * physicsRate * warpSteps;
+        steps = int(std::min(std::floor(physicsAccumulator), double(maxWarpSteps)));
+    }
+    bool keepLast = physicsRate > 0.0 && interpolation;
+    int taken = 0;
+    while (taken < steps) {
+        if (keepLast) {
+            for (auto& obj : objs) obj.LastPos = obj.position;
+        }
+        StepPhysics(objs);
+        ++taken;
+        if (!deterministic && glfwGetTime() - start > warpBudget) break;
+    }
+    if (physicsRate > 0.0) {
+        // a batch cut short (or capped) falls behind real time rather than owing the steps
+        physicsAccumulator -= taken;
+        physicsAccumulator -= std::floor(physicsAccumulator);
+        renderAlpha = keepLast ? float(physicsAccumulator) : 1.0f;
+    } else {
+        renderAlpha = 1.0f;
+    }
+}
+
+// the positions drawn this frame, put back by RestorePositions once it is drawn. Grid, meshes
+// and sprites all read Object::position, so the whole frame is in between. A body being placed
+// is where the mouse put it.
+std::vector<glm::vec3> heldPositions;
+
+void InterpolatePositions(std::vector<Object>& objs){
+    heldPositions.resize(objs.size());
+    for (size_t i = 0; i < objs.size(); ++i) {
+        heldPositions[i] = objs[i].position;
+        if (!objs[i].Initalizing) objs[i].position = glm::mix(objs[i].LastPos, objs[i].position, renderAlpha);
+    }
+}
+void RestorePositions(std::vector<Object>& objs){
+    for (size_t i = 0; i < objs.size(); ++i) objs[i].position = heldPositions[i];
+}
+
+std::vector<Object> DefaultScene(){
+    return {
+        //Object(glm::vec3(3844, 0, 0), glm::vec3(0, 0, 228), 7.34767309*pow(10, 22), 3344),
+        //Object(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), 1.989 * pow(10, 30), 5515, glm::vec4(1.0f, 0.929f, 0.176f, 1.0f)),
+       //Object(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), 5.97219*pow(10, 24), 5515, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)),
+       Object(glm::vec3(-5000, 650, -350), glm::vec3(0, 0, 1500), 5.97219*pow(10, 22), 5515, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)),
+       Object(glm::vec3(5000, 650, -350), glm::vec3(0, 0, -1500), 5.97219*pow(10, 22), 5515, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)),
+       Object(glm::vec3(0, 0, -350), glm::vec3(0, 0, 0), 1.989 * pow(10, 25), 5515, glm::vec4(1.0f, 0.929f, 0.176f, 1.0f), true),
+
+    };
+}
+
+// uniform ball of equal bodies in slow rotation, for throughput runs. Body i only depends on i,
+// so any index range can be generated on its own (one range per MPI rank).
+uint64_t clusterBodies = 0;
+float clusterRadius = 20000.0f;
+Object ClusterBody(uint64_t i){
+    std::mt19937_64 rng(0x9e3779b97f4a7c15ull ^ (i * 0xbf58476d1ce4e5b9ull));
+    std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+    glm::vec3 p;
+    do {
+        p = glm::vec3(u(rng), u(rng), u(rng));
+    } while (glm::dot(p, p) > 1.0f);
+    glm::vec3 v = glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), p) * 300.0f + glm::vec3(u(rng), u(rng), u(rng)) * 50.0f;
+    return Object(p * clusterRadius, v, 1e22f, 5515);
+}
+std::vector<Object> ClusterScene(uint64_t first, uint64_t last){
+    std::vector<Object> scene;
+    scene.reserve(last - first);
+    for (uint64_t i = first; i < last; ++i) {
+        scene.push_back(ClusterBody(i));
+    }
+    return scene;
+}
+
+// offscreen recording: the scene is rendered into an FBO every recordInterval steps, read back
+// through a ring of pixel-buffer objects (a frame is mapped two captures after it was issued, so
+// glReadPixels never waits on the GPU) and written by a background thread as PNGs or into ffmpeg
+std::string recordTarget;       // "frames/run" -> frames/run_000001.png, "ffmpeg:out.mp4" -> pipe
+int recordInterval = 10;
+int recordWidth = 1920, recordHeight = 1080;
+
+uint32_t Crc32(uint32_t crc, const unsigned char* data, size_t n){
+    static uint32_t table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        ready = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// uncompressed (stored deflate) RGB PNG, rows flipped from GL's bottom-up order
+bool WritePNG(const std::string& path, const unsigned char* rgb, int width, int height){
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    auto be32 = [](std::vector<unsigned char>& v, uint32_t x) {
+        v.push_back(x >> 24); v.push_back(x >> 16); v.push_back(x >> 8); v.push_back(x);
+    };
+    auto chunk = [&out, &be32](const char* type, const std::vector<unsigned char>& data) {
+        std::vector<unsigned char> buf;
+        be32(buf, uint32_t(data.size()));
+        buf.insert(buf.end(), type, type + 4);
+        buf.insert(buf.end(), data.begin(), data.end());
+        be32(buf, Crc32(0, buf.data() + 4, buf.size() - 4));
+        out.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+    };
+
+    std::vector<unsigned char> raw;
+    size_t stride = size_t(width) * 3;
+    raw.reserve((stride + 1) * height);
+    for (int y = height - 1; y >= 0; --y) {
+        raw.push_back(0); // filter: none
+        raw.insert(raw.end(), rgb + y * stride, rgb + (y + 1) * stride);
+    }
+
+    std::vector<unsigned char> ihdr;
+    be32(ihdr, width);
+    be32(ihdr, height);
+    ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 }); // 8-bit RGB
+    std::vector<unsigned char> idat = { 0x78, 0x01 };
+    uint32_t a = 1, b = 0;
+    for (size_t pos = 0; pos < raw.size() || pos == 0; ) {
+        size_t len = std::min<size_t>(65535, raw.size() - pos);
+        bool last = pos + len == raw.size();
+        idat.push_back(last ? 1 : 0);
+        idat.push_back(len & 0xff); idat.push_back(len >> 8);
+        idat.push_back(~len & 0xff); idat.push_back((~len >> 8) & 0xff);
+        idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+        for (size_t i = pos; i < pos + len; ++i) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        pos += len;
+        if (last) break;
+    }
+    be32(idat, (b << 16) | a);
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.write(reinterpret_cast<const char*>(signature), 8);
+    chunk("IHDR", ihdr);
+    chunk("IDAT", idat);
+    chunk("IEND", {});
+    return bool(out);
+}
+
+class FrameRecorder {
+    public:
+        int width = 0, height = 0;
+        GLuint fbo = 0, colorRb = 0, depthRb = 0;
+        GLuint pbos[3] = { 0, 0, 0 };
+        uint64_t issued = 0, written = 0, dropped = 0;
+
+        bool Open(const std::string& target, int w, int h) {
+            width = w;
+            height = h;
+            if (target.rfind("ffmpeg:", 0) == 0) {
+                std::string cmd = "ffmpeg -y -loglevel error -f rawvideo -pix_fmt rgb24 -s " + std::to_string(w) + "x" + std::to_string(h)
+                                + " -r 30 -i - -vf vflip -pix_fmt yuv420p \"" + target.substr(7) + "\"";
+                pipe = popen(cmd.c_str(), "w");
+                if (!pipe) {
+                    std::cerr << "Failed to start ffmpeg." << std::endl;
+                    return false;
+                }
+            } else {
+                prefix = target;
+            }
+
+            glGenFramebuffers(1, &fbo);
+            glGenRenderbuffers(1, &colorRb);
+            glGenRenderbuffers(1, &depthRb);
+            glBindRenderbuffer(GL_RENDERBUFFER, colorRb);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+            glBindRenderbuffer(GL_RENDERBUFFER, depthRb);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRb);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRb);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cerr << "Offscreen framebuffer incomplete." << std::endl;
+                return false;
+            }
+
+            glGenBuffers(3, pbos);
+            for (GLuint pbo : pbos) {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+                glBufferData(GL_PIXEL_PACK_BUFFER, FrameBytes(), nullptr, GL_STREAM_READ);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            writer = std::thread(&FrameRecorder::WriterLoop, this);
+            return true;
+        }
+
+        // render target for the next frame
+        void Bind() {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glViewport(0, 0, width, height);
+        }
+
+        // queue a readback of what was just drawn, hand the frame from two captures ago to the writer
+        void Capture() {
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[issued % 3]);
+            glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+            ++issued;
+            if (issued >= 3) Collect(pbos[(issued - 3) % 3]);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        void Close() {
+            if (!fbo) return;
+            // the last two readbacks are still in flight
+            for (uint64_t k = issued >= 2 ? issued - 2 : 0; k < issued; ++k) Collect(pbos[k % 3]);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+            }
+            ready.notify_one();
+            if (writer.joinable()) writer.join();
+            if (pipe) pclose(pipe);
+            glDeleteBuffers(3, pbos);
+            glDeleteRenderbuffers(1, &colorRb);
+            glDeleteRenderbuffers(1, &depthRb);
+            glDeleteFramebuffers(1, &fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            fbo = 0;
+            std::cout<<"recorded "<<written<<" frames";
+            if (dropped > 0) std::cout<<", dropped "<<dropped<<" (writer too slow)";
+            std::cout<<std::endl;
+        }
+
+    private:
+        static const size_t maxQueued = 16;
+        std::string prefix;
+        FILE* pipe = nullptr;
+        std::thread writer;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<std::vector<unsigned char>> queue;
+        std::vector<std::vector<unsigned char>> spare;
+        bool done = false;
+
+        size_t FrameBytes() const { return size_t(width) * height * 3; }
+
+        // maps pbo, leaving the pack binding as it was; never blocks on the writer, a full queue drops
+        void Collect(GLuint pbo) {
+            GLint bound = 0;
+            glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &bound);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+            void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, FrameBytes(), GL_MAP_READ_BIT);
+            if (!pixels) {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, GLuint(bound));
+                return;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            if (queue.size() >= maxQueued) {
+                ++dropped;
+            } else {
+                std::vector<unsigned char> frame;
+                if (!spare.empty()) {
+                    frame.swap(spare.back());
+                    spare.pop_back();
+                }
+                frame.resize(FrameBytes());
+                const unsigned char* src = static_cast<const unsigned char*>(pixels);
+                std::copy(src, src + FrameBytes(), frame.begin());
+                queue.push_back(std::move(frame));
+            }
+            lock.unlock();
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, GLuint(bound));
+            ready.notify_one();
+        }
+
+        void WriterLoop() {
+            uint64_t index = 0;
+            for (;;) {
+                std::vector<unsigned char> frame;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this] { return done || !queue.empty(); });
+                    if (queue.empty()) return;
+                    frame.swap(queue.front());
+                    queue.pop_front();
+                }
+                ++index;
+                if (pipe) {
+                    fwrite(frame.data(), 1, frame.size(), pipe);
+                } else {
+                    char name[32];
+                    snprintf(name, sizeof(name), "_%06llu.png", (unsigned long long)index);
+                    if (!WritePNG(prefix + name, frame.data(), width, height)) {
+                        std::cerr << "Failed to write " << prefix + name << std::endl;
+                    }
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                ++written;
+                spare.push_back(std::move(frame));
+            }
+        }
+};
+
+// GL context without a window: EGL pbuffer when built with -DUSE_EGL, otherwise a hidden GLFW window
+bool StartOffscreenGL(){
+#ifdef USE_EGL
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+        std::cerr << "Failed to initialize EGL." << std::endl;
+        return false;
+    }
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0) {
+        std::cerr << "No EGL config for offscreen rendering." << std::endl;
+        return false;
+    }
+    const EGLint surfaceAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+    eglBindAPI(EGL_OPENGL_API);
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, gpuPhysics ? 4 : 3, EGL_CONTEXT_MINOR_VERSION, 3,   // 4.3 for compute shaders
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)) {
+        std::cerr << "Failed to create EGL context." << std::endl;
+        return false;
+    }
+    glewExperimental = GL_TRUE;
+    GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY) err = GLEW_OK; // expected without X, GL entry points still load
+#endif
+    if (err != GLEW_OK) {
+        std::cerr << "Failed to initialize GLEW." << std::endl;
+        return false;
+    }
+#else
+    if (!glfwInit()) {
+        std::cout << "Failed to initialize GLFW, panic" << std::endl;
+        return false;
+    }
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(1, 1, "offscreen", NULL, NULL);
+    if (!window) {
+        std::cerr << "Failed to create hidden GLFW window." << std::endl;
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(window);
+    glewExperimental = GL_TRUE;
+    if (glewInit() != GLEW_OK) {
+        std::cerr << "Failed to initialize GLEW." << std::endl;
+        glfwTerminate();
+        return false;
+    }
+#endif
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    return true;
+}
+
+// no window: step the default scene (or --cluster N) for regression runs. Without --record
+// there is no GL at all, with it frames go through the offscreen recorder.
+int RunHeadless(uint64_t steps){
+    GLuint shaderProgram = 0;
+    FrameRecorder recorder;
+    std::vector<float> gridVertices;
+    bool recording = !recordTarget.empty();
+    if ((recording || gpuPhysics) && !StartOffscreenGL()) return 1;
+    if (gpuPhysics && !gpu.Start()) gpuPhysics = false;
+    if (recording) {
+        shaderProgram = CreateShaderProgram(vertexShaderSource, fragmentShaderSource);
+        glUseProgram(shaderProgram);
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(recordWidth) / float(recordHeight), 0.1f, 750000.0f);
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        cameraPos = glm::vec3(0.0f, 1000.0f, 5000.0f);
+        if (!recorder.Open(recordTarget, recordWidth, recordHeight)) return 1;
+    }
+
+    registry.Assign(clusterBodies > 0 ? ClusterScene(0, clusterBodies) : DefaultScene());
+    if (recording) {
+        gridVertices = CreateGridVertices(20000.0f, 25, objs);
+        CreateVBOVAO(gridVAO, gridVBO, gridVertices.data(), gridVertices.size());
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (simStep < steps) {
+        StepPhysics(objs);
+        if (recording && simStep % recordInterval == 0) {
+            recorder.Bind();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            UpdateCam(shaderProgram, cameraPos);
+            DrawScene(shaderProgram, gridVertices);
+            recorder.Capture();
+        }
+    }
+    if (recording) recorder.Close();
+    gpu.Pull(objs);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout<<steps<<" steps, "<<objs.size()<<" bodies in "<<seconds<<" s ("<<(steps > 0 ? 1000.0 * seconds / steps : 0.0)<<" ms/step)"<<std::endl;
+    std::cout<<"final hash "<<std::hex<<std::setw(16)<<std::setfill('0')<<StateHash(objs)<<std::dec<<std::endl;
+    return 0;
+}
+
+// --gpu-parity: the same scene stepped by the CPU kernel and by GpuPhysics side by side. Ten
+// times over the run the GPU state is pulled and compared, positions against the size of the
+// system and velocities against the fastest body; exits non-zero past gpuParityTolerance.
+// Needs nothing but a GL 4.3 context, so it runs on llvmpipe (software Mesa) under EGL.
+int RunGpuParity(uint64_t steps){
+    if (!StartOffscreenGL() || !gpu.Start()) return 1;
+    if (!GpuStepping()) {
+        std::cerr << "GPU parity covers Newtonian and Plummer forces without --kepler, --encounters or --deterministic." << std::endl;
+        return 1;
+    }
+    registry.Assign(clusterBodies > 0 ? ClusterScene(0, clusterBodies) : DefaultScene());
+    std::vector<Object> reference = objs;
+    uint64_t checkInterval = std::max<uint64_t>(1, steps / 10);
+    double cpuSeconds = 0.0, gpuSeconds = 0.0, worst = 0.0;
+    for (uint64_t step = 1; step <= steps; ++step) {
+        auto start = std::chrono::steady_clock::now();
+        stepKernel(reference, accScratch, softening, nullptr);
+        auto middle = std::chrono::steady_clock::now();
+        gpu.Step(objs);
+        glFinish();
+        cpuSeconds += std::chrono::duration<double>(middle - start).count();
+        gpuSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - middle).count();
+        if (step % checkInterval != 0 && step != steps) continue;
+
+        gpu.Pull(objs);
+        glm::dvec3 centre(0.0);
+        for (const auto& obj : reference) centre += glm::dvec3(obj.position);
+        centre /= double(std::max<size_t>(1, reference.size()));
+        double extent = 0.0, speed = 0.0, positionError = 0.0, velocityError = 0.0;
+        for (size_t i = 0; i < reference.size(); ++i) {
+            extent = std::max(extent, glm::length(glm::dvec3(reference[i].position) - centre));
+            speed = std::max(speed, glm::length(glm::dvec3(reference[i].velocity)));
+            positionError = std::max(positionError, glm::length(glm::dvec3(objs[i].position) - glm::dvec3(reference[i].position)));
+            velocityError = std::max(velocityError, glm::length(glm::dvec3(objs[i].velocity) - glm::dvec3(reference[i].velocity)));
+        }
+        if (extent > 0.0) positionError /= extent;
+        if (speed > 0.0) velocityError /= speed;
+        worst = std::max(worst, std::max(positionError, velocityError));
+        std::cout<<"parity step="<<step<<" position="<<positionError<<" velocity="<<velocityError<<std::endl;
+    }
+    std::cout<<steps<<" steps, "<<objs.size()<<" bodies: cpu "<<1000.0 * cpuSeconds / std::max<uint64_t>(1, steps)
+             <<" ms/step, gpu "<<1000.0 * gpuSeconds / std::max<uint64_t>(1, steps)<<" ms/step"<<std::endl;
+    bool pass = worst <= gpuParityTolerance;
+    std::cout<<"gpu parity "<<(pass ? "passed" : "FAILED")<<", worst "<<worst<<" (tolerance "<<gpuParityTolerance<<")"<<std::endl;
+    return pass ? 0 : 1;
+}
+
+// --pn-check: a test particle on an e = 0.5 orbit with GM / (c^2 a) ~ 7e-4 is followed for ten
+// orbits under PostNewtonian and under Newtonian forces (RK4, 20000 steps per orbit), and the
+// extra turn of its periapsis per orbit is compared with the 1PN value 6 pi GM / (c^2 a (1 - e^2)).
+// Taking the Newtonian run's own drift off leaves the integrator out of it.
+bool pnCheck = false;
+
+template<class Law>
+double PeriapsisAdvance(double gm, double a, double e, int orbits){
+    const int stepsPerOrbit = 20000;
+    const double period = 2.0 * 3.14159265358979323846 * std::sqrt(a * a * a / gm);
+    const double h = period / stepsPerOrbit;
+    glm::dvec3 x(a * (1.0 - e), 0.0, 0.0);
+    glm::dvec3 v(0.0, 0.0, std::sqrt(gm / a * (1.0 + e) / (1.0 - e)));
+    // d and dv point from the particle to the central mass, which sits at rest at the origin
+    auto accel = [gm](const glm::dvec3& p, const glm::dvec3& u) { return Law::Accel(-p, -u, gm, 0.0); };
+    double first = 0.0, last = 0.0;
+    int passages = 0;
+    for (long step = 0; step < long(orbits + 1) * stepsPerOrbit && passages <= orbits; ++step) {
+        glm::dvec3 k1x = v, k1v = accel(x, v);
+        glm::dvec3 k2x = v + 0.5 * h * k1v, k2v = accel(x + 0.5 * h * k1x, k2x);
+        glm::dvec3 k3x = v + 0.5 * h * k2v, k3v = accel(x + 0.5 * h * k2x, k3x);
+        glm::dvec3 k4x = v + h * k3v, k4v = accel(x + h * k3x, k4x);
+        glm::dvec3 nx = x + h / 6.0 * (k1x + 2.0 * k2x + 2.0 * k3x + k4x);
+        glm::dvec3 nv = v + h / 6.0 * (k1v + 2.0 * k2v + 2.0 * k3v + k4v);
+        // periapsis where r.v turns positive, its angle interpolated between the two samples
+        double before = glm::dot(x, v), after = glm::dot(nx, nv);
+        if (step > 0 && before < 0.0 && after >= 0.0) {
+            double t = before / (before - after);
+            glm::dvec3 p = glm::mix(x, nx, t);
+            double angle = std::atan2(p.z, p.x);
+            if (passages == 0) first = angle;
+            // unwrap, each orbit turns the periapsis by far less than pi
+            last = angle + 2.0 * 3.14159265358979323846 * std::round((last - angle) / (2.0 * 3.14159265358979323846));
+            ++passages;
+        }
+        x = nx;
+        v = nv;
+    }
+    return (last - first) / std::max(1, passages - 1);
+}
+
+int RunPrecessionCheck(){
+    const double gm = G * 1e32, a = 1e8, e = 0.5;
+    const double c2 = double(c) * double(c);
+    double expected = 6.0 * 3.14159265358979323846 * gm / (c2 * a * (1.0 - e * e));
+    double measured = PeriapsisAdvance<PostNewtonian>(gm, a, e, 10) - PeriapsisAdvance<Newtonian>(gm, a, e, 10);
+    double error = std::abs(measured - expected) / expected;
+    // room for the higher orders and for sampling the periapsis between steps
+    bool pass = error < 0.01;
+    std::cout<<"periapsis advance "<<measured<<" rad/orbit, 1PN "<<expected<<" rad/orbit, error "<<100.0 * error<<"%"<<std::endl;
+    std::cout<<"post-Newtonian check "<<(pass ? "passed" : "FAILED")<<std::endl;
+    return pass ? 0 : 1;
+}
+
+// parameter sweep: the cartesian product of a parameter grid, every variant a small headless
+// system of its own (orbiters on alternating sides of a central body, pair 0 is DefaultScene),
+// run on all cores with one summary row per run.
+//   --sweep "central=1e25,2e25;speed=1200:1800:4;size=30000"   (list, or lo:hi:count)
+std::string sweepSpec;
+std::string sweepOut;
+unsigned sweepThreads = 0;      // 0 = one per hardware thread
+bool sweepLanes = false;        // batch same-sized systems into SIMD lanes, see SweepLanes
+
+struct SweepVariant {
+    double central = 1.989 * pow(10, 25);
+    double mass = 5.97219 * pow(10, 22);   // per orbiter
+    double speed = 1500.0;
+    double distance = 5000.0;
+    double size = 30000.0;                 // sizeRatio
+    int orbiters = 2;
+};
+
+struct SweepResult {
+    size_t bodies = 0;
+    double maxError = 0.0;      // max |dE/E0| over the samples
+    double finalError = 0.0;
+    double seconds = 0.0;       // lane runs share their batch time evenly
+    uint64_t hash = 0;
+};
+
+bool ParseSweep(const std::string& spec, std::vector<SweepVariant>& variants){
+    variants.assign(1, SweepVariant());
+    std::stringstream axes(spec);
+    std::string axis;
+    while (std::getline(axes, axis, ';')) {
+        size_t eq = axis.find('=');
+        if (eq == std::string::npos) return false;
+        std::string name = axis.substr(0, eq);
+        std::vector<double> values;
+        std::stringstream list(axis.substr(eq + 1));
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            double lo, hi;
+            int count;
+            if (sscanf(item.c_str(), "%lf:%lf:%d", &lo, &hi, &count) == 3 && count > 0) {
+                for (int k = 0; k < count; ++k) {
+                    values.push_back(count > 1 ? lo + (hi - lo) * k / (count - 1) : lo);
+                }
+            } else {
+                values.push_back(std::stod(item));
+            }
+        }
+        if (values.empty()) return false;
+
+        std::vector<SweepVariant> product;
+        product.reserve(variants.size() * values.size());
+        for (const auto& base : variants) {
+            for (double value : values) {
+                SweepVariant v = base;
+                if (name == "central") v.central = value;
+                else if (name == "mass") v.mass = value;
+                else if (name == "speed") v.speed = value;
+                else if (name == "distance") v.distance = value;
+                else if (name == "size") v.size = value;
+                else if (name == "orbiters") v.orbiters = std::max(0, int(value));
+                else return false;
+                product.push_back(v);
+            }
+        }
+        variants.swap(product);
+    }
+    return true;
+}
+
+// built on the calling thread: Object ids come from the global counter and start at 0 per run
+std::vector<Object> SweepScene(const SweepVariant& v){
+    float savedRatio = sizeRatio;
+    uint32_t savedId = nextObjectId;
+    sizeRatio = float(v.size);
+    nextObjectId = 0;
+    std::vector<Object> scene;
+    scene.reserve(v.orbiters + 1);
+    for (int k = 0; k < v.orbiters; ++k) {
+        float ring = float(k / 2 + 1);
+        float side = k % 2 == 0 ? -1.0f : 1.0f;
+        scene.push_back(Object(glm::vec3(side * float(v.distance) * ring, 650.0f, -350.0f),
+                               glm::vec3(0.0f, 0.0f, -side * float(v.speed) / std::sqrt(ring)),
+                               v.mass, 5515, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)));
+    }
+    scene.push_back(Object(glm::vec3(0.0f, 0.0f, -350.0f), glm::vec3(0.0f), v.central, 5515, glm::vec4(1.0f, 0.929f, 0.176f, 1.0f), true));
+    sizeRatio = savedRatio;
+    nextObjectId = savedId;
+    return scene;
+}
+
+template<class Law, class Units>
+double TotalEnergy(const std::vector<Object>& objs, std::vector<glm::dvec3>& acc, double eps){
+    Diagnostics d;
+    MeasureDiagnostics<Units>(objs, d);
+    acc.assign(objs.size(), glm::dvec3(0.0));
+    return d.kinetic + AccumulateForces<Law, Units, false, true, true>(objs, objs, acc, eps * Units::length);
+}
+
+typedef double (*EnergyFn)(const std::vector<Object>&, std::vector<glm::dvec3>&, double);
+
+template<class Units>
+EnergyFn SelectEnergy(ForceLaw law){
+    switch (law) {
+        case ForceLaw::Plummer:       return TotalEnergy<PlummerSoftened, Units>;
+        case ForceLaw::Spline:        return TotalEnergy<SplineSoftened, Units>;
+        case ForceLaw::PostNewtonian: return TotalEnergy<PostNewtonian, Units>;
+        default:                      return TotalEnergy<Newtonian, Units>;
+    }
+}
+EnergyFn SelectEnergy(ForceLaw law, UnitSystem units){
+    return units == UnitSystem::SI ? SelectEnergy<SIUnits>(law) : SelectEnergy<SimUnits>(law);
+}
+
+// width same-sized systems stepped together, body i of lane l at i * width + l, so every inner
+// loop runs across independent systems and vectorises (build with -O3 -fno-math-errno so the
+// square roots do too). Same arithmetic in the same order as StepKernel, so a lane reproduces
+// the scalar run bit for bit; the collision distance uses sqrtf where Object uses powf(x, 0.5f).
+struct SweepLanes {
+    static constexpr int width = 8;
+    size_t bodies = 0;
+    std::vector<float> px, py, pz, vx, vy, vz, mass, radius;
+    std::vector<double> ax, ay, az;
+
+    void Resize(size_t n) {
+        bodies = n;
+        for (auto* a : { &px, &py, &pz, &vx, &vy, &vz, &mass, &radius }) a->assign(n * width, 0.0f);
+        for (auto* a : { &ax, &ay, &az }) a->assign(n * width, 0.0);
+    }
+    void Gather(const std::vector<Object>& objs, int lane) {
+        for (size_t i = 0; i < bodies; ++i) {
+            size_t k = i * width + lane;
+            px[k] = objs[i].position.x; py[k] = objs[i].position.y; pz[k] = objs[i].position.z;
+            vx[k] = objs[i].velocity.x; vy[k] = objs[i].velocity.y; vz[k] = objs[i].velocity.z;
+            mass[k] = objs[i].mass;
+            radius[k] = objs[i].radius;
+        }
+    }
+    void Scatter(std::vector<Object>& objs, int lane) const {
+        for (size_t i = 0; i < bodies; ++i) {
+            size_t k = i * width + lane;
+            objs[i].position = glm::vec3(px[k], py[k], pz[k]);
+            objs[i].velocity = glm::vec3(vx[k], vy[k], vz[k]);
+        }
+    }
+};
+
+// Newtonian and Plummer only: Newtonian is Plummer with eps = 0 to the last bit
+template<class Law, class Units>
+void StepLanes(SweepLanes& b, double eps){
+    constexpr int W = SweepLanes::width;
+    const double epsM = eps * Units::length;
+    const double eps2 = std::is_same<Law, Newtonian>::value ? 0.0 : epsM * epsM;
+    const size_t n = b.bodies;
+    for (size_t i = 0; i < n; ++i) {
+        const size_t bi = i * W;
+        double sx[W] = {}, sy[W] = {}, sz[W] = {};
+        for (size_t j = 0; j < n; ++j) {
+            if (j == i) continue;
+            const size_t bj = j * W;
+            for (int l = 0; l < W; ++l) {
+                double dx = double(b.px[bj + l]) * Units::length - double(b.px[bi + l]) * Units::length;
+                double dy = double(b.py[bj + l]) * Units::length - double(b.py[bi + l]) * Units::length;
+                double dz = double(b.pz[bj + l]) * Units::length - double(b.pz[bi + l]) * Units::length;
+                double d2 = dx * dx + dy * dy + dz * dz;
+                double r2 = d2 + eps2;
+                double r = std::sqrt(r2);
+                double f = d2 == 0.0 ? 0.0 : G * double(b.mass[bj + l]) / (r2 * r);
+                sx[l] += dx * f;
+                sy[l] += dy * f;
+                sz[l] += dz * f;
+            }
+        }
+        for (int l = 0; l < W; ++l) {
+            b.ax[bi + l] = sx[l];
+            b.ay[bi + l] = sy[l];
+            b.az[bi + l] = sz[l];
+        }
+    }
+
+    const float kick = float(Units::kick * stepScale), drift = float(Units::drift * stepScale);
+    for (size_t i = 0; i < n; ++i) {
+        const size_t bi = i * W;
+        for (int l = 0; l < W; ++l) {
+            b.vx[bi + l] += float(b.ax[bi + l]) * kick;
+            b.vy[bi + l] += float(b.ay[bi + l]) * kick;
+            b.vz[bi + l] += float(b.az[bi + l]) * kick;
+        }
+        for (size_t j = 0; j < n; ++j) {
+            if (j == i) continue;
+            const size_t bj = j * W;
+            for (int l = 0; l < W; ++l) {
+                float dx = b.px[bj + l] - b.px[bi + l];
+                float dy = b.py[bj + l] - b.py[bi + l];
+                float dz = b.pz[bj + l] - b.pz[bi + l];
+                float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+                float bounce = b.radius[bj + l] + b.radius[bi + l] > distance ? -0.2f : 1.0f;
+                b.vx[bi + l] *= bounce;
+                b.vy[bi + l] *= bounce;
+                b.vz[bi + l] *= bounce;
+            }
+        }
+    }
+    for (size_t k = 0; k < n * W; ++k) {
+        b.px[k] += b.vx[k] * drift;
+        b.py[k] += b.vy[k] * drift;
+        b.pz[k] += b.vz[k] * drift;
+    }
+}
+
+typedef void (*LaneStepFn)(SweepLanes&, double);
+
+template<class Units>
+LaneStepFn SelectLaneKernel(ForceLaw law){
+    switch (law) {
+        case ForceLaw::Plummer:   return StepLanes<PlummerSoftened, Units>;
+        case ForceLaw::Newtonian: return StepLanes<Newtonian, Units>;
+        default:                  return nullptr;
+    }
+}
+// nullptr when the force law or the deterministic mode has no lane kernel
+LaneStepFn SelectLaneKernel(ForceLaw law, UnitSystem units, bool compensated){
+    if (compensated) return nullptr;
+    return units == UnitSystem::SI ? SelectLaneKernel<SIUnits>(law) : SelectLaneKernel<SimUnits>(law);
+}
+
+// energy error bookkeeping of one run
+struct SweepMonitor {
+    double initial = 0.0;
+    bool started = false;
+    void Sample(double energy, SweepResult& result) {
+        if (!started) {
+            initial = energy;
+            started = true;
+        }
+        result.finalError = initial != 0.0 ? (energy - initial) / std::abs(initial) : 0.0;
+        result.maxError = std::max(result.maxError, std::abs(result.finalError));
+    }
+};
+
+int RunSweep(const std::string& spec, uint64_t steps){
+    std::vector<SweepVariant> variants;
+    try {
+        if (!ParseSweep(spec, variants)) throw std::invalid_argument(spec);
+    } catch (const std::exception&) {
+        std::cerr << "Bad --sweep, expected name=v1,v2,...;name=lo:hi:count with name one of central, mass, speed, distance, size, orbiters." << std::endl;
+        return 1;
+    }
+    std::vector<std::vector<Object>> scenes;
+    scenes.reserve(variants.size());
+    for (const auto& v : variants) scenes.push_back(SweepScene(v));
+
+    StepFn step = SelectStepKernel(forceLaw, unitSystem, deterministic, keplerMode);
+    EnergyFn energy = SelectEnergy(forceLaw, unitSystem);
+    LaneStepFn laneStep = sweepLanes && !keplerMode && !encounters ? SelectLaneKernel(forceLaw, unitSystem, deterministic) : nullptr;
+    if (sweepLanes && !laneStep) {
+        std::cerr << "No lane kernel for this force law / mode, running one system per thread." << std::endl;
+    }
+
+    // a job is one run, or up to width runs with the same body count when batching into lanes
+    std::vector<std::vector<size_t>> jobs;
+    if (laneStep) {
+        std::vector<size_t> order(variants.size());
+        for (size_t k = 0; k < order.size(); ++k) order[k] = k;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scenes[a].size() < scenes[b].size(); });
+        for (size_t k : order) {
+            if (jobs.empty() || jobs.back().size() == SweepLanes::width || scenes[jobs.back()[0]].size() != scenes[k].size()) {
+                jobs.emplace_back();
+            }
+            jobs.back().push_back(k);
+        }
+    } else {
+        for (size_t k = 0; k < variants.size(); ++k) jobs.push_back({ k });
+    }
+
+    std::vector<SweepResult> results(variants.size());
+    std::atomic<size_t> nextJob(0);
+    auto worker = [&]() {
+        std::vector<glm::dvec3> acc;
+        SweepLanes lanes;
+        for (size_t j = nextJob++; j < jobs.size(); j = nextJob++) {
+            const std::vector<size_t>& runs = jobs[j];
+            auto start = std::chrono::steady_clock::now();
+            std::vector<SweepMonitor> monitors(runs.size());
+            if (laneStep) {
+                // short batches repeat their last system in the spare lanes
+                lanes.Resize(scenes[runs[0]].size());
+                for (int l = 0; l < SweepLanes::width; ++l) {
+                    lanes.Gather(scenes[runs[std::min<size_t>(l, runs.size() - 1)]], l);
+                }
+                auto sample = [&]() {
+                    for (size_t l = 0; l < runs.size(); ++l) {
+                        lanes.Scatter(scenes[runs[l]], int(l));
+                        monitors[l].Sample(energy(scenes[runs[l]], acc, softening), results[runs[l]]);
+                    }
+                };
+                for (uint64_t s = 0; s < steps; ++s) {
+                    if (s == 0 || (diagInterval > 0 && s % diagInterval == 0)) sample();
+                    laneStep(lanes, softening);
+                }
+                sample();
+            } else {
+                std::vector<Object>& run = scenes[runs[0]];
+                sizeRatio = float(variants[runs[0]].size);
+                for (uint64_t s = 0; s < steps; ++s) {
+                    if (s == 0 || (diagInterval > 0 && s % diagInterval == 0)) {
+                        monitors[0].Sample(energy(run, acc, softening), results[runs[0]]);
+                    }
+                    step(run, acc, softening, nullptr);
+                }
+                monitors[0].Sample(energy(run, acc, softening), results[runs[0]]);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            for (size_t k : runs) {
+                results[k].bodies = scenes[k].size();
+                results[k].seconds = seconds / runs.size();
+                results[k].hash = StateHash(scenes[k]);
+            }
+        }
+    };
+
+    unsigned threads = sweepThreads > 0 ? sweepThreads : std::max(1u, std::thread::hardware_concurrency());
+    threads = unsigned(std::min<size_t>(threads, jobs.size()));
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ofstream file;
+    if (!sweepOut.empty()) {
+        file.open(sweepOut);
+        if (!file) {
+            std::cerr << "Failed to open sweep output file." << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = file.is_open() ? static_cast<std::ostream&>(file) : std::cout;
+    out<<"run\tcentral\tmass\tspeed\tdistance\tsize\tbodies\tsteps\tmax_dE/E0\tfinal_dE/E0\tms\thash\n";
+    for (size_t k = 0; k < variants.size(); ++k) {
+        const SweepVariant& v = variants[k];
+        const SweepResult& r = results[k];
+        out<<k<<'\t'<<v.central<<'\t'<<v.mass<<'\t'<<v.speed<<'\t'<<v.distance<<'\t'<<v.size<<'\t'
+           <<r.bodies<<'\t'<<steps<<'\t'<<r.maxError<<'\t'<<r.finalError<<'\t'<<1000.0 * r.seconds<<'\t'
+           <<std::hex<<std::setw(16)<<std::setfill('0')<<r.hash<<std::dec<<std::setfill(' ')<<'\n';
+    }
+    out.flush();
+    std::cerr<<"sweep: "<<variants.size()<<" runs x "<<steps<<" steps on "<<threads<<" threads"
+             <<(laneStep ? " in lanes of 8" : "")<<", "<<seconds<<" s"<<std::endl;
+    return 0;
+}
+
+
+
+// read-only memory map, so a replay only touches the pages of the frames it shows
+class MappedFile {
+    public:
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+
+        bool Open(const std::string& path) {
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file == INVALID_HANDLE_VALUE) return false;
+            LARGE_INTEGER length;
+            GetFileSizeEx(file, &length);
+            size = size_t(length.QuadPart);
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (!mapping) return false;
+            data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+            // stdio rather than <unistd.h>, whose pause() would clash with ours
+            file = fopen(path.c_str(), "rb");
+            if (!file) return false;
+            struct stat st;
+            if (fstat(fileno(file), &st) != 0) return false;
+            size = size_t(st.st_size);
+            void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fileno(file), 0);
+            data = p == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(p);
+#endif
+            return data != nullptr;
+        }
+        ~MappedFile() {
+#ifdef _WIN32
+            if (data) UnmapViewOfFile(data);
+            if (mapping) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+            if (data) munmap(const_cast<unsigned char*>(data), size);
+            if (file) fclose(file);
+#endif
+        }
+
+    private:
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = NULL;
+#else
+        FILE* file = nullptr;
+#endif
+};
+
+class Trajectory {
+    public:
+        MappedFile file;
+        std::vector<size_t> frameOffsets;   // byte offset of every TrajectoryFrame
+
+        bool Open(const std::string& path) {
+            if (!file.Open(path)) {
+                std::cerr << "Failed to map trajectory " << path << std::endl;
+                return false;
+            }
+            TrajectoryHeader header;
+            if (file.size < sizeof(header)) return false;
+            std::memcpy(&header, file.data, sizeof(header));
+            if (std::memcmp(header.magic, "GSIMTRJ1", 8) != 0 || header.bodyBytes != sizeof(TrajectoryBody)) {
+                std::cerr << "Not a trajectory file: " << path << std::endl;
+                return false;
+            }
+            // only frame headers are touched while indexing
+            size_t at = sizeof(header);
+            while (at + sizeof(TrajectoryFrame) <= file.size) {
+                const TrajectoryFrame* frame = Frame(at);
+                size_t end = at + sizeof(TrajectoryFrame) + frame->count * sizeof(TrajectoryBody);
+                if (end > file.size) break; // truncated tail of a run that is still going
+                frameOffsets.push_back(at);
+                at = end;
+            }
+            return !frameOffsets.empty();
+        }
+        size_t FrameCount() const { return frameOffsets.size(); }
+        const TrajectoryFrame* Frame(size_t offset) const {
+            return reinterpret_cast<const TrajectoryFrame*>(file.data + offset);
+        }
+        const TrajectoryFrame* FrameAt(size_t index) const { return Frame(frameOffsets[index]); }
+        const TrajectoryBody* Bodies(size_t index) const {
+            return reinterpret_cast<const TrajectoryBody*>(file.data + frameOffsets[index] + sizeof(TrajectoryFrame));
+        }
+};
+
+// replay: the main loop shows stored frames instead of stepping physics
+bool replaying = false;
+Trajectory replay;
+double replayHead = 0.0;        // fractional frame index
+double replaySpeed = 1.0;       // stored frames per rendered frame at 60 fps
+bool replayPaused = false;
+
+// bring objs to the state at replayHead, lerping positions of bodies present in both neighbouring frames
+void ApplyReplayFrame(std::vector<Object>& objs){
+    size_t last = replay.FrameCount() - 1;
+    replayHead = std::min(std::max(replayHead, 0.0), double(last));
+    size_t a = size_t(replayHead);
+    size_t b = std::min(a + 1, last);
+    float t = float(replayHead - double(a));
+
+    const TrajectoryBody* from = replay.Bodies(a);
+    const TrajectoryBody* to = replay.Bodies(b);
+    size_t fromCount = replay.FrameAt(a)->count;
+    size_t toCount = replay.FrameAt(b)->count;
+    static std::unordered_map<uint32_t, size_t> toIndex;
+    toIndex.clear();
+    for (size_t i = 0; i < toCount; ++i) toIndex[to[i].id] = i;
+
+    // objs mirrors frame a one to one, reuse meshes where the body is unchanged
+    bool sameSet = objs.size() == fromCount;
+    for (size_t i = 0; sameSet && i < fromCount; ++i) {
+        sameSet = objs[i].id == from[i].id && objs[i].mass == from[i].mass;
+    }
+    if (!sameSet) {
+        objs.clear();
+        for (size_t i = 0; i < fromCount; ++i) {
+            objs.emplace_back(from[i].position, glm::vec3(0.0f), from[i].mass, from[i].density, from[i].color, from[i].glow != 0);
+            objs.back().id = from[i].id;
+        }
+        registry.Adopt();
+    }
+    for (size_t i = 0; i < fromCount; ++i) {
+        auto it = toIndex.find(from[i].id);
+        glm::vec3 target = it != toIndex.end() ? to[it->second].position : from[i].position;
+        objs[i].position = glm::mix(from[i].position, target, t);
+    }
+}
+
+#ifdef USE_MPI
+// distributed mode: every rank owns one contiguous Morton-key range of the bodies.
+// Each step the ranks swap domain boxes and monopoles; a remote domain that is well
+// separated (size < domainTheta * distance) is felt through its monopole, otherwise its
+// bodies are shipped over as ghosts, i.e. a domain-level locally essential tree.
+float domainTheta = 0.5f;
+int rebalanceInterval = 50;
+int checkpointInterval = 0;
+std::string checkpointPrefix = "checkpoint";
+
+struct DomainSummary {
+    glm::vec3 lo;
+    glm::vec3 hi;
+    Ghost monopole;
+    uint64_t count;
+};
+// what migrates between ranks and what goes into a checkpoint
+struct BodyRecord {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    glm::vec4 color;
+    float mass;
+    float density;
+    int glow;
+    uint32_t id;    // Object::id, kept across migrations and restarts
+};
+
+BodyRecord ToRecord(const Object& obj){
+    return { obj.position, obj.velocity, obj.color, obj.mass, obj.density, obj.glow ? 1 : 0, obj.id };
+}
+Object FromRecord(const BodyRecord& rec){
+    Object obj(rec.position, rec.velocity, rec.mass, rec.density, rec.color, rec.glow != 0);
+    obj.id = rec.id;
+    nextObjectId = std::max(nextObjectId, rec.id + 1);
+    return obj;
+}
+
+template<class Law, class Units>
+void DistributedStepKernel(std::vector<Object>& objs, const std::vector<Ghost>& ghosts, std::vector<glm::dvec3>& acc, double eps, Diagnostics* diag){
+    const double epsM = eps * Units::length;
+    acc.assign(objs.size(), glm::dvec3(0.0));
+    if (diag) {
+        MeasureDiagnostics<Units>(objs, *diag);
+        diag->potential = AccumulateForces<Law, Units, false, true, true>(objs, objs, acc, epsM)
+                        + AccumulateForces<Law, Units, false, true, false>(objs, ghosts, acc, epsM);
+    } else {
+        AccumulateForces<Law, Units, false, false, true>(objs, objs, acc, epsM);
+        AccumulateForces<Law, Units, false, false, false>(objs, ghosts, acc, epsM);
+    }
+    // collisions are only resolved between bodies on the same rank
+    IntegrateKernel<Units>(objs, acc);
+}
+
+typedef void (*DistributedStepFn)(std::vector<Object>&, const std::vector<Ghost>&, std::vector<glm::dvec3>&, double, Diagnostics*);
+
+template<class Units>
+DistributedStepFn SelectDistributedKernel(ForceLaw law){
+    switch (law) {
+        case ForceLaw::Plummer:       return DistributedStepKernel<PlummerSoftened, Units>;
+        case ForceLaw::Spline:        return DistributedStepKernel<SplineSoftened, Units>;
+        case ForceLaw::PostNewtonian: return DistributedStepKernel<PostNewtonian, Units>;
+        default:                      return DistributedStepKernel<Newtonian, Units>;
+    }
+}
+DistributedStepFn SelectDistributedKernel(ForceLaw law, UnitSystem units){
+    return units == UnitSystem::SI ? SelectDistributedKernel<SIUnits>(law) : SelectDistributedKernel<SimUnits>(law);
+}
+
+DomainSummary SummariseDomain(const std::vector<Object>& objs){
+    DomainSummary d;
+    d.lo = glm::vec3(std::numeric_limits<float>::max());
+    d.hi = glm::vec3(-std::numeric_limits<float>::max());
+    d.count = objs.size();
+    double mass = 0.0;
+    glm::dvec3 com(0.0), mom(0.0);
+    for (const auto& obj : objs) {
+        d.lo = glm::min(d.lo, obj.position);
+        d.hi = glm::max(d.hi, obj.position);
+        mass += obj.mass;
+        com += glm::dvec3(obj.position) * double(obj.mass);
+        mom += glm::dvec3(obj.velocity) * double(obj.mass);
+    }
+    d.monopole.mass = float(mass);
+    d.monopole.radius = 0.0f;
+    d.monopole.position = mass > 0.0 ? glm::vec3(com / mass) : glm::vec3(0.0f);
+    d.monopole.velocity = mass > 0.0 ? glm::vec3(mom / mass) : glm::vec3(0.0f);
+    return d;
+}
+
+// can target feel source through its monopole alone?
+bool WellSeparated(const DomainSummary& source, const DomainSummary& target){
+    if (source.count == 0 || target.count == 0) return true;
+    glm::vec3 gap = glm::max(glm::max(source.lo - target.hi, target.lo - source.hi), glm::vec3(0.0f));
+    glm::vec3 extent = source.hi - source.lo;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    return size < domainTheta * glm::length(gap);
+}
+
+// byte-wise all-to-all of per-rank buckets of trivially copyable T
+template<class T>
+std::vector<T> ExchangeBuckets(const std::vector<std::vector<T>>& buckets){
+    int ranks = int(buckets.size());
+    std::vector<int> sendCounts(ranks), recvCounts(ranks), sendOffsets(ranks), recvOffsets(ranks);
+    std::vector<T> sendBuf;
+    for (int r = 0; r < ranks; ++r) {
+        sendCounts[r] = int(buckets[r].size() * sizeof(T));
+        sendOffsets[r] = int(sendBuf.size() * sizeof(T));
+        sendBuf.insert(sendBuf.end(), buckets[r].begin(), buckets[r].end());
+    }
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    int total = 0;
+    for (int r = 0; r < ranks; ++r) {
+        recvOffsets[r] = total;
+        total += recvCounts[r];
+    }
+    std::vector<T> recvBuf(total / sizeof(T));
+    MPI_Alltoallv(sendBuf.data(), sendCounts.data(), sendOffsets.data(), MPI_BYTE,
+                  recvBuf.data(), recvCounts.data(), recvOffsets.data(), MPI_BYTE, MPI_COMM_WORLD);
+    return recvBuf;
+}
+
+void ExchangeGhosts(const std::vector<Object>& objs, std::vector<Ghost>& ghosts){
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    DomainSummary mine = SummariseDomain(objs);
+    std::vector<DomainSummary> domains(ranks);
+    MPI_Allgather(&mine, sizeof(DomainSummary), MPI_BYTE, domains.data(), sizeof(DomainSummary), MPI_BYTE, MPI_COMM_WORLD);
+
+    std::vector<std::vector<Ghost>> buckets(ranks);
+    for (int r = 0; r < ranks; ++r) {
+        if (r == rank || WellSeparated(mine, domains[r])) continue;
+        buckets[r].reserve(objs.size());
+        for (const auto& obj : objs) {
+            if (!obj.Initalizing) buckets[r].push_back({ obj.position, obj.velocity, obj.mass, obj.radius });
+        }
+    }
+    ghosts = ExchangeBuckets(buckets);
+    for (int r = 0; r < ranks; ++r) {
+        if (r != rank && WellSeparated(domains[r], mine)) ghosts.push_back(domains[r].monopole);
+    }
+}
+
+// re-split the Morton curve so every rank gets the same share of the measured force cost
+void Rebalance(std::vector<Object>& objs, double cost){
+    const int samplesPerRank = 64;
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    DomainSummary mine = SummariseDomain(objs);
+    glm::vec3 lo, hi;
+    MPI_Allreduce(&mine.lo, &lo, 3, MPI_FLOAT, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(&mine.hi, &hi, 3, MPI_FLOAT, MPI_MAX, MPI_COMM_WORLD);
+    glm::vec3 extent = hi - lo;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+
+    std::vector<std::pair<uint64_t, size_t>> keys(objs.size());
+    for (size_t i = 0; i < objs.size(); ++i) {
+        keys[i] = { MortonKey(objs[i].position, lo, size), i };
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // weighted samples: the local key range cut into equal-count blocks, each carrying its cost
+    struct Sample { uint64_t key; double weight; };
+    double perBody = objs.empty() ? 0.0 : std::max(cost, 1e-9) / objs.size();
+    std::vector<Sample> samples(samplesPerRank, Sample{ ~0ull, 0.0 });
+    for (int s = 0; s < samplesPerRank && !keys.empty(); ++s) {
+        size_t begin = keys.size() * s / samplesPerRank;
+        size_t end = keys.size() * (s + 1) / samplesPerRank;
+        if (end == begin) continue;
+        samples[s] = { keys[end - 1].first, perBody * (end - begin) };
+    }
+    std::vector<Sample> all(samplesPerRank * ranks);
+    MPI_Allgather(samples.data(), samplesPerRank * sizeof(Sample), MPI_BYTE, all.data(), samplesPerRank * sizeof(Sample), MPI_BYTE, MPI_COMM_WORLD);
+    std::sort(all.begin(), all.end(), [](const Sample& a, const Sample& b) { return a.key < b.key; });
+
+    double total = 0.0;
+    for (const auto& smp : all) total += smp.weight;
+    std::vector<uint64_t> splitters;
+    double running = 0.0;
+    for (const auto& smp : all) {
+        running += smp.weight;
+        while (int(splitters.size()) < ranks - 1 && running >= total * (splitters.size() + 1) / ranks) {
+            splitters.push_back(smp.key);
+        }
+    }
+    while (int(splitters.size()) < ranks - 1) splitters.push_back(~0ull);
+
+    std::vector<std::vector<BodyRecord>> buckets(ranks);
+    for (const auto& k : keys) {
+        int dest = int(std::lower_bound(splitters.begin(), splitters.end(), k.first) - splitters.begin());
+        buckets[dest].push_back(ToRecord(objs[k.second]));
+    }
+    std::vector<BodyRecord> mineNow = ExchangeBuckets(buckets);
+
+    // arrivals come grouped by sender, which is already key order
+    objs.clear();
+    objs.reserve(mineNow.size());
+    for (const auto& rec : mineNow) {
+        objs.push_back(FromRecord(rec));
+    }
+}
+
+// one file per checkpoint, written collectively: header then every rank's bodies in rank order
+void WriteCheckpoint(const std::vector<Object>& objs, uint64_t step){
+    struct Header { char magic[8]; uint64_t step; uint64_t count; };
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    uint64_t count = objs.size(), offset = 0, total = 0;
+    MPI_Exscan(&count, &offset, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) offset = 0;
+    MPI_Allreduce(&count, &total, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+
+    std::vector<BodyRecord> records;
+    records.reserve(objs.size());
+    for (const auto& obj : objs) records.push_back(ToRecord(obj));
+
+    std::string path = checkpointPrefix + "." + std::to_string(step) + ".ckpt";
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        if (rank == 0) std::cerr << "Failed to open checkpoint " << path << std::endl;
+        return;
+    }
+    // an older, longer file of the same name would keep its tail
+    MPI_File_set_size(file, 0);
+    if (rank == 0) {
+        // version 2 records carry the body id
+        Header header = { { 'G', 'S', 'I', 'M', 'C', 'K', 'P', '2' }, step, total };
+        MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_Offset at = sizeof(Header) + MPI_Offset(offset * sizeof(BodyRecord));
+    MPI_File_write_at_all(file, at, records.data(), int(records.size() * sizeof(BodyRecord)), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+}
+
+// mpirun -np 4 gravity_sim --headless STEPS --distributed N
+int RunDistributed(uint64_t bodies, uint64_t steps){
+    MPI_Init(nullptr, nullptr);
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    // ids are the global cluster index, unique across ranks
+    nextObjectId = uint32_t(bodies * rank / ranks);
+    objs = ClusterScene(bodies * rank / ranks, bodies * (rank + 1) / ranks);
+    DistributedStepFn step = SelectDistributedKernel(forceLaw, unitSystem);
+    std::vector<Ghost> ghosts;
+    std::vector<glm::dvec3> acc;
+    Rebalance(objs, 1.0);
+
+    double cost = 0.0, lastCost = 0.0, start = MPI_Wtime();
+    while (simStep < steps) {
+        ExchangeGhosts(objs, ghosts);
+        bool sample = diagInterval > 0 && simStep % diagInterval == 0;
+        Diagnostics local;
+        double t0 = MPI_Wtime();
+        step(objs, ghosts, acc, softening, sample ? &local : nullptr);
+        cost += MPI_Wtime() - t0;
+        if (sample) {
+            double sums[8] = { local.kinetic, local.potential,
+                               local.momentum.x, local.momentum.y, local.momentum.z,
+                               local.angularMomentum.x, local.angularMomentum.y, local.angularMomentum.z };
+            double global[8];
+            MPI_Reduce(sums, global, 8, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+            if (rank == 0) {
+                diag.step = simStep;
+                diag.kinetic = global[0];
+                diag.potential = global[1];
+                diag.momentum = glm::dvec3(global[2], global[3], global[4]);
+                diag.angularMomentum = glm::dvec3(global[5], global[6], global[7]);
+                ReportDiagnostics(diag);
+            }
+        }
+        ++simStep;
+        if (simStep % rebalanceInterval == 0) {
+            Rebalance(objs, cost);
+            lastCost = cost;
+            cost = 0.0;
+        }
+        if (checkpointInterval > 0 && simStep % checkpointInterval == 0) {
+            WriteCheckpoint(objs, simStep);
+        }
+    }
+
+    // per-rank load after the last rebalance window
+    double report[2] = { double(objs.size()), lastCost > 0.0 ? lastCost : cost };
+    std::vector<double> loads(2 * ranks);
+    MPI_Gather(report, 2, MPI_DOUBLE, loads.data(), 2, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        std::cout<<"distributed: "<<steps<<" steps on "<<ranks<<" ranks in "<<(MPI_Wtime() - start)<<" s"<<std::endl;
+        for (int r = 0; r < ranks; ++r) {
+            std::cout<<"  rank "<<r<<": "<<uint64_t(loads[2 * r])<<" bodies, force time "<<loads[2 * r + 1]<<" s"<<std::endl;
+        }
+    }
+    MPI_Finalize();
+    return 0;
+}
+#endif
+
+// input: the GLFW callbacks only record what happened, as timestamped actions through a binding
+// table. Once per frame, before anything steps, HandleInput replays the queue in order (toggles,
+// placement, replay transport) and the camera moves by how long each movement key was held
+// during the frame, so its speed follows the clock and not the key-repeat rate. An idle frame
+// costs an empty queue. --bindings FILE overrides keys, one "action KEY" per line.
+enum class Action : uint8_t {
+    None, Forward, Back, Left, Right, Up, Down, Pause, Quit,
+    WarpSlower, WarpFaster, WarpReset,
+    ToggleInspector, ToggleEmitter, ToggleBloom, ToggleImpostors, ToggleCulling, ToggleGrid,
+    CycleForceLaw, ToggleEncounters, ToggleKepler,
+    ReplayPlay, ReplaySlower, ReplayFaster, ReplayBack, ReplayForward, ReplayStart, ReplayEnd,
+    NudgeUp, NudgeDown, NudgeLeft, NudgeRight, Drop,
+    Place, Grow, Inspect,
+    Count
+};
+
+struct InputEvent {
+    Action action;
+    int state;      // GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT
+    int mods;
+    double time;
+};
+
+class Input {
+    public:
+        // mouse buttons share the key table, after the last key
+        static constexpr int mouseKey = GLFW_KEY_LAST + 1;
+        static constexpr int keyCount = mouseKey + 8;
+
+        Input() {
+            std::fill(bindings, bindings + keyCount, Action::None);
+            for (const Binding& b : defaults) bindings[b.key] = b.action;
+            std::fill(heldSince, heldSince + size_t(Action::Count), -1.0);
+            std::fill(heldTime, heldTime + size_t(Action::Count), 0.0);
+        }
+
+        // "forward UP" binds UP to forward on top of its default key, "none W" unbinds W
+        bool Load(const std::string& path) {
+            std::ifstream in(path);
+            if (!in) {
+                std::cerr << "Failed to open bindings file " << path << std::endl;
+                return false;
+            }
+            std::string line;
+            for (int number = 1; std::getline(in, line); ++number) {
+                line = line.substr(0, line.find('#'));
+                std::istringstream fields(line);
+                std::string name, keyName;
+                if (!(fields >> name)) continue;
+                fields >> keyName;
+                Action action = Action::Count;
+                if (name == "none") action = Action::None;
+                for (const Binding& b : defaults) {
+                    if (name == b.name) action = b.action;
+                }
+                int key = KeyByName(keyName);
+                if (action == Action::Count || key < 0) {
+                    std::cerr << path << ":" << number << ": expected \"action KEY\", got \"" << line << "\"" << std::endl;
+                    return false;
+                }
+                bindings[key] = action;
+            }
+            return true;
+        }
 
-                    // Triangle 1: v1-v2-v3
-                    vertices.insert(vertices.end(), {v1.x, v1.y, v1.z}); //      /|
-                    vertices.insert(vertices.end(), {v2.x, v2.y, v2.z}); //     / |
-                    vertices.insert(vertices.end(), {v3.x, v3.y, v3.z}); //    /__|
-                    
-                    // Triangle 2: v2-v4-v3
-                    vertices.insert(vertices.end(), {v2.x, v2.y, v2.z});
-                    vertices.insert(vertices.end(), {v4.x, v4.y, v4.z});
-                    vertices.insert(vertices.end(), {v3.x, v3.y, v3.z});
-                }   
+        void Key(int key, int state, int mods, double time) {
+            if (key >= 0 && key < mouseKey) Push(bindings[key], state, mods, time);
+        }
+        void Button(int button, int state, int mods, double time) {
+            if (button >= 0 && mouseKey + button < keyCount) Push(bindings[mouseKey + button], state, mods, time);
+        }
+
+        // take the events queued since the last frame and work out how long each action was held
+        void Begin(double now) {
+            std::swap(queue, frame);
+            queue.clear();
+            std::fill(heldTime, heldTime + size_t(Action::Count), 0.0);
+            for (const InputEvent& e : frame) {
+                size_t a = size_t(e.action);
+                if (e.state == GLFW_PRESS && heldSince[a] < 0.0) {
+                    heldSince[a] = e.time;
+                } else if (e.state == GLFW_RELEASE && heldSince[a] >= 0.0) {
+                    heldTime[a] += e.time - std::max(heldSince[a], frameStart);
+                    heldSince[a] = -1.0;
+                }
             }
-            return vertices;
+            for (size_t a = 0; a < size_t(Action::Count); ++a) {
+                if (heldSince[a] >= 0.0) heldTime[a] += now - std::max(heldSince[a], frameStart);
+            }
+            frameStart = now;
         }
-        
-        void UpdatePos(){
-            this->position[0] += this->velocity[0] / 94;
-            this->position[1] += this->velocity[1] / 94;
-            this->position[2] += this->velocity[2] / 94;
-            this->radius = pow(((3 * this->mass/this->density)/(4 * 3.14159265359)), (1.0f/3.0f)) / sizeRatio;
+        const std::vector<InputEvent>& Events() const {
+            return frame;
         }
-        void UpdateVertices() {
-            // generate new vertices with current radius
-            std::vector<float> vertices = Draw();
-            
-            // update VBO with new vertex data
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        bool Held(Action a) const {
+            return heldSince[size_t(a)] >= 0.0;
         }
-        glm::vec3 GetPos() const {
-            return this->position;
+        // seconds of the last frame the action was held for
+        double HeldFor(Action a) const {
+            return heldTime[size_t(a)];
         }
-        void accelerate(float x, float y, float z){
-            this->velocity[0] += x / 96;
-            this->velocity[1] += y / 96;
-            this->velocity[2] += z / 96;
+
+    private:
+        struct Binding {
+            Action action;
+            const char* name;
+            int key;
+        };
+        static constexpr Binding defaults[] = {
+            { Action::Forward, "forward", GLFW_KEY_W },
+            { Action::Back, "back", GLFW_KEY_S },
+            { Action::Left, "left", GLFW_KEY_A },
+            { Action::Right, "right", GLFW_KEY_D },
+            { Action::Up, "up", GLFW_KEY_SPACE },
+            { Action::Down, "down", GLFW_KEY_LEFT_SHIFT },
+            { Action::Pause, "pause", GLFW_KEY_K },
+            { Action::Quit, "quit", GLFW_KEY_Q },
+            { Action::WarpSlower, "warp-slower", GLFW_KEY_MINUS },
+            { Action::WarpFaster, "warp-faster", GLFW_KEY_EQUAL },
+            { Action::WarpReset, "warp-reset", GLFW_KEY_0 },
+            { Action::ToggleInspector, "inspector", GLFW_KEY_H },
+            { Action::ToggleEmitter, "emitter", GLFW_KEY_E },
+            { Action::ToggleBloom, "bloom", GLFW_KEY_B },
+            { Action::ToggleImpostors, "impostors", GLFW_KEY_I },
+            { Action::ToggleCulling, "culling", GLFW_KEY_C },
+            { Action::ToggleGrid, "adaptive-grid", GLFW_KEY_G },
+            { Action::CycleForceLaw, "force-law", GLFW_KEY_F },
+            { Action::ToggleEncounters, "encounters", GLFW_KEY_R },
+            { Action::ToggleKepler, "kepler", GLFW_KEY_O },
+            { Action::ReplayPlay, "replay-play", GLFW_KEY_P },
+            { Action::ReplaySlower, "replay-slower", GLFW_KEY_LEFT_BRACKET },
+            { Action::ReplayFaster, "replay-faster", GLFW_KEY_RIGHT_BRACKET },
+            { Action::ReplayBack, "replay-back", GLFW_KEY_COMMA },
+            { Action::ReplayForward, "replay-forward", GLFW_KEY_PERIOD },
+            { Action::ReplayStart, "replay-start", GLFW_KEY_HOME },
+            { Action::ReplayEnd, "replay-end", GLFW_KEY_END },
+            { Action::NudgeUp, "nudge-up", GLFW_KEY_UP },
+            { Action::NudgeDown, "nudge-down", GLFW_KEY_DOWN },
+            { Action::NudgeLeft, "nudge-left", GLFW_KEY_LEFT },
+            { Action::NudgeRight, "nudge-right", GLFW_KEY_RIGHT },
+            { Action::Drop, "drop", GLFW_KEY_DELETE },
+            { Action::Place, "place", mouseKey + GLFW_MOUSE_BUTTON_LEFT },
+            { Action::Grow, "grow", mouseKey + GLFW_MOUSE_BUTTON_RIGHT },
+            { Action::Inspect, "inspect", mouseKey + GLFW_MOUSE_BUTTON_MIDDLE },
+        };
+
+        Action bindings[keyCount];
+        std::vector<InputEvent> queue, frame;
+        double heldSince[size_t(Action::Count)];   // -1 = up
+        double heldTime[size_t(Action::Count)];
+        double frameStart = 0.0;
+
+        void Push(Action action, int state, int mods, double time) {
+            if (action != Action::None) queue.push_back(InputEvent{ action, state, mods, time });
         }
-        float CheckCollision(const Object& other) {
-            float dx = other.position[0] - this->position[0];
-            float dy = other.position[1] - this->position[1];
-            float dz = other.position[2] - this->position[2];
-            float distance = std::pow(dx*dx + dy*dy + dz*dz, (1.0f/2.0f));
-            if (other.radius + this->radius > distance){
-                return -0.2f;
+
+        // A-Z, 0-9 and the punctuation GLFW names by its ASCII code, or a name from the list
+        static int KeyByName(std::string name) {
+            for (char& ch : name) ch = char(std::toupper((unsigned char)ch));
+            if (name.size() == 1 && std::strchr("ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-=[],./;'`\\", name[0])) return name[0];
+            static const std::pair<const char*, int> named[] = {
+                { "SPACE", GLFW_KEY_SPACE }, { "MINUS", GLFW_KEY_MINUS }, { "EQUAL", GLFW_KEY_EQUAL },
+                { "COMMA", GLFW_KEY_COMMA }, { "PERIOD", GLFW_KEY_PERIOD },
+                { "LEFT_BRACKET", GLFW_KEY_LEFT_BRACKET }, { "RIGHT_BRACKET", GLFW_KEY_RIGHT_BRACKET },
+                { "ESCAPE", GLFW_KEY_ESCAPE }, { "ENTER", GLFW_KEY_ENTER }, { "TAB", GLFW_KEY_TAB },
+                { "BACKSPACE", GLFW_KEY_BACKSPACE }, { "DELETE", GLFW_KEY_DELETE },
+                { "UP", GLFW_KEY_UP }, { "DOWN", GLFW_KEY_DOWN }, { "LEFT", GLFW_KEY_LEFT }, { "RIGHT", GLFW_KEY_RIGHT },
+                { "PAGE_UP", GLFW_KEY_PAGE_UP }, { "PAGE_DOWN", GLFW_KEY_PAGE_DOWN },
+                { "HOME", GLFW_KEY_HOME }, { "END", GLFW_KEY_END },
+                { "LEFT_SHIFT", GLFW_KEY_LEFT_SHIFT }, { "LEFT_CONTROL", GLFW_KEY_LEFT_CONTROL },
+                { "MOUSE_LEFT", mouseKey + GLFW_MOUSE_BUTTON_LEFT }, { "MOUSE_RIGHT", mouseKey + GLFW_MOUSE_BUTTON_RIGHT },
+                { "MOUSE_MIDDLE", mouseKey + GLFW_MOUSE_BUTTON_MIDDLE },
+            };
+            for (const auto& n : named) {
+                if (name == n.first) return n.second;
             }
-            return 1.0f;
+            if (name.size() >= 2 && name[0] == 'F' && std::isdigit((unsigned char)name[1])) {
+                int f = std::atoi(name.c_str() + 1);
+                if (f >= 1 && f <= 12) return GLFW_KEY_F1 + f - 1;
+            }
+            return -1;
         }
 };
-std::vector<Object> objs = {};
-
-std::vector<float> CreateGridVertices(float size, int divisions, const std::vector<Object>& objs);
-std::vector<float> UpdateGridVertices(std::vector<float> vertices, const std::vector<Object>& objs);
-
-GLuint gridVAO, gridVBO;
+Input input;
 
+int main(int argc, char** argv) {
+    uint64_t headlessSteps = 0;
+    uint64_t distributedBodies = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--deterministic") {
+            deterministic = true;
+        } else if (arg == "--hash-every" && i + 1 < argc) {
+            hashInterval = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--diag-every" && i + 1 < argc) {
+            diagInterval = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--telemetry" && i + 1 < argc) {
+            telemetryFile.open(argv[++i]);
+            if (telemetryFile) telemetry = &telemetryFile;
+            else std::cerr << "Failed to open telemetry file, using stdout." << std::endl;
+        } else if (arg == "--sort-every" && i + 1 < argc) {
+            sortInterval = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--cluster" && i + 1 < argc) {
+            clusterBodies = std::stoull(argv[++i]);
+        } else if (arg == "--distributed" && i + 1 < argc) {
+            distributedBodies = std::stoull(argv[++i]);
+#ifdef USE_MPI
+        } else if (arg == "--rebalance-every" && i + 1 < argc) {
+            rebalanceInterval = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+            checkpointInterval = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointPrefix = argv[++i];
+#endif
+        } else if (arg == "--record" && i + 1 < argc) {
+            recordTarget = argv[++i];
+        } else if (arg == "--record-every" && i + 1 < argc) {
+            recordInterval = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--record-size" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &recordWidth, &recordHeight) != 2 || recordWidth <= 0 || recordHeight <= 0) {
+                std::cerr << "Bad --record-size, expected WxH." << std::endl;
+                return 1;
+            }
+        } else if (arg == "--trajectory" && i + 1 < argc) {
+            if (!OpenTrajectory(argv[++i])) return 1;
+        } else if (arg == "--trajectory-every" && i + 1 < argc) {
+            trajectoryInterval = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--replay" && i + 1 < argc) {
+            if (!replay.Open(argv[++i])) return 1;
+            replaying = true;
+        } else if (arg == "--adaptive-grid") {
+            adaptiveGrid = true;
+        } else if (arg == "--emit" && i + 1 < argc) {
+            emitter.active = true;
+            emitter.rate = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--emit-mass" && i + 1 < argc) {
+            emitter.mass = std::stof(argv[++i]);
+        } else if (arg == "--emit-spread" && i + 1 < argc) {
+            emitter.speedSpread = std::stof(argv[++i]);
+        } else if (arg == "--emit-limit" && i + 1 < argc) {
+            emitter.limit = std::stoull(argv[++i]);
+        } else if (arg == "--warp" && i + 1 < argc) {
+            warpSteps = std::min(maxWarpSteps, std::max(1, std::stoi(argv[++i])));
+        } else if (arg == "--physics-rate" && i + 1 < argc) {
+            physicsRate = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--no-interpolation") {
+            interpolation = false;
+        } else if (arg == "--kepler") {
+            keplerMode = true;
+        } else if (arg == "--kepler-tolerance" && i + 1 < argc) {
+            keplerTolerance = std::stod(argv[++i]);
+        } else if (arg == "--force-law" && i + 1 < argc) {
+            std::string law = argv[++i];
+            if (law == "newtonian") forceLaw = ForceLaw::Newtonian;
+            else if (law == "plummer") forceLaw = ForceLaw::Plummer;
+            else if (law == "spline") forceLaw = ForceLaw::Spline;
+            else if (law == "pn") forceLaw = ForceLaw::PostNewtonian;
+            else {
+                std::cerr << "Bad --force-law, expected newtonian, plummer, spline or pn." << std::endl;
+                return 1;
+            }
+        } else if (arg == "--units" && i + 1 < argc) {
+            std::string units = argv[++i];
+            if (units == "sim") unitSystem = UnitSystem::Sim;
+            else if (units == "si") unitSystem = UnitSystem::SI;
+            else {
+                std::cerr << "Bad --units, expected sim or si." << std::endl;
+                return 1;
+            }
+        } else if (arg == "--softening" && i + 1 < argc) {
+            softening = std::max(0.0f, std::stof(argv[++i]));
+        } else if (arg == "--step-scale" && i + 1 < argc) {
+            stepScale = std::stod(argv[++i]);
+        } else if (arg == "--encounters") {
+            encounters = true;
+        } else if (arg == "--encounter-steps" && i + 1 < argc) {
+            encounterSteps = std::stod(argv[++i]);
+        } else if (arg == "--lod") {
+            lodPhysics = true;
+        } else if (arg == "--lod-theta" && i + 1 < argc) {
+            lodTheta = std::stof(argv[++i]);
+        } else if (arg == "--lod-link" && i + 1 < argc) {
+            lodLink = std::stof(argv[++i]);
+        } else if (arg == "--lod-min" && i + 1 < argc) {
+            lodMinBodies = std::max(2, std::stoi(argv[++i]));
+        } else if (arg == "--lod-interval" && i + 1 < argc) {
+            lodInterval = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--gpu-physics") {
+            gpuPhysics = true;
+        } else if (arg == "--gpu-double") {
+            gpuDouble = true;
+        } else if (arg == "--gpu-sync" && i + 1 < argc) {
+            gpuSyncFrames = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--pn-check") {
+            pnCheck = true;
+        } else if (arg == "--gpu-parity") {
+            gpuPhysics = gpuParity = true;
+        } else if (arg == "--gpu-parity-tolerance" && i + 1 < argc) {
+            gpuParityTolerance = std::stod(argv[++i]);
+        } else if (arg == "--bindings" && i + 1 < argc) {
+            if (!input.Load(argv[++i])) return 1;
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            if (!metricsServer.Start(std::stoi(argv[++i]))) return 1;
+        } else if (arg == "--no-bloom") {
+            bloom = false;
+        } else if (arg == "--impostors") {
+            impostors = true;
+        } else if (arg == "--no-culling") {
+            culling = false;
+        } else if (arg == "--grid-budget" && i + 1 < argc) {
+            gridVertexBudget = std::max(64, std::stoi(argv[++i]));
+        } else if (arg == "--sweep" && i + 1 < argc) {
+            sweepSpec = argv[++i];
+        } else if (arg == "--sweep-out" && i + 1 < argc) {
+            sweepOut = argv[++i];
+        } else if (arg == "--sweep-threads" && i + 1 < argc) {
+            sweepThreads = unsigned(std::max(0, std::stoi(argv[++i])));
+        } else if (arg == "--sweep-lanes") {
+            sweepLanes = true;
+        } else if (arg == "--headless" && i + 1 < argc) {
+            headless = true;
+            headlessSteps = std::stoull(argv[++i]);
+        }
+    }
+    // LodStepKernel has neither compensated sums nor the Kepler and encounter paths
+    if (lodPhysics && (deterministic || keplerMode || encounters)) {
+        std::cerr << "--lod cannot be combined with --deterministic, --kepler or --encounters." << std::endl;
+        return 1;
+    }
+    // everything that picks a kernel is known now; the sweep and distributed runs select their own from the same globals
+    stepKernel = SelectStepKernel(forceLaw, unitSystem, deterministic, keplerMode, lodPhysics);
+    if (distributedBodies > 0) {
+#ifdef USE_MPI
+        headless = true;
+        return RunDistributed(distributedBodies, headlessSteps);
+#else
+        std::cerr << "Distributed mode needs a build with -DUSE_MPI (mpicxx)." << std::endl;
+        return 1;
+#endif
+    }
+    if (!sweepSpec.empty()) {
+        return RunSweep(sweepSpec, headlessSteps > 0 ? headlessSteps : 1000);
+    }
+    if (gpuParity) {
+        return RunGpuParity(headlessSteps > 0 ? headlessSteps : 1000);
+    }
+    if (pnCheck) {
+        return RunPrecessionCheck();
+    }
+    if (headless) {
+        return RunHeadless(headlessSteps);
+    }
 
-int main() {
     GLFWwindow* window = StartGLU();
     GLuint shaderProgram = CreateShaderProgram(vertexShaderSource, fragmentShaderSource);
+    // a replay only draws recorded frames, there is nothing to step
+    if (gpuPhysics && (replaying || !gpu.Start())) gpuPhysics = false;
 
-    GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-    GLint objectColorLoc = glGetUniformLocation(shaderProgram, "objectColor");
     glUseProgram(shaderProgram);
 
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetKeyCallback(window, keyCallback);
+    glfwSetMouseButtonCallback(window, mouseButtonCallback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     //projection matrix
@@ -195,117 +4133,79 @@ int main() {
     cameraPos = glm::vec3(0.0f, 1000.0f, 5000.0f);
 
     
-    objs = {
-        //Object(glm::vec3(3844, 0, 0), glm::vec3(0, 0, 228), 7.34767309*pow(10, 22), 3344),
-        //Object(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), 1.989 * pow(10, 30), 5515, glm::vec4(1.0f, 0.929f, 0.176f, 1.0f)),
-       //Object(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), 5.97219*pow(10, 24), 5515, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)),
-       Object(glm::vec3(-5000, 650, -350), glm::vec3(0, 0, 1500), 5.97219*pow(10, 22), 5515, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)),
-       Object(glm::vec3(5000, 650, -350), glm::vec3(0, 0, -1500), 5.97219*pow(10, 22), 5515, glm::vec4(0.0f, 1.0f, 1.0f, 1.0f)),
-       Object(glm::vec3(0, 0, -350), glm::vec3(0, 0, 0), 1.989 * pow(10, 25), 5515, glm::vec4(1.0f, 0.929f, 0.176f, 1.0f), true),
-
-    };
+    if (replaying) {
+        ApplyReplayFrame(objs);
+    } else {
+        registry.Assign(DefaultScene());
+    }
     std::vector<float> gridVertices = CreateGridVertices(20000.0f, 25, objs);
     CreateVBOVAO(gridVAO, gridVBO, gridVertices.data(), gridVertices.size());
+    int framesSinceSync = 0;
 
     while (!glfwWindowShouldClose(window) && running == true) {
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
+        double currentFrame = glfwGetTime();
+        deltaTime = float(currentFrame - lastFrame);
         lastFrame = currentFrame;
+        // simulation-side timing must not depend on the frame rate in deterministic mode
+        float simDt = deterministic ? fixedDt : deltaTime;
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glfwSetKeyCallback(window, keyCallback);
-        glfwSetMouseButtonCallback(window, mouseButtonCallback);
+        HandleInput(window, currentFrame);
         UpdateCam(shaderProgram, cameraPos);
-        if (!objs.empty() && objs.back().Initalizing) {
-            if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
+        if (Object* placed = registry.Get(placing)) {
+            if (input.Held(Action::Grow)) {
                 // increase mass by 1% per second
-                objs.back().mass *= 1.0 + 1.0 * deltaTime;
+                placed->mass *= 1.0 + 1.0 * simDt;
                 
                 // update radius based on new mass
-                objs.back().radius = pow(
-                    (3 * objs.back().mass / objs.back().density) / 
+                placed->radius = pow(
+                    (3 * placed->mass / placed->density) / 
                     (4 * 3.14159265359f), 
                     1.0f/3.0f
                 ) / sizeRatio;
                 
                 // update vertex data
-                objs.back().UpdateVertices();
+                placed->UpdateVertices();
             }
         }
 
-        // Draw the grid
-        glUseProgram(shaderProgram);
-        glUniform4f(objectColorLoc, 1.0f, 1.0f, 1.0f, 0.25f);
-        glUniform1i(glGetUniformLocation(shaderProgram, "isGrid"), 1);
-        glUniform1i(glGetUniformLocation(shaderProgram, "GLOW"), 0);
-        gridVertices = UpdateGridVertices(gridVertices, objs);
-        glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
-        glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(float), gridVertices.data(), GL_DYNAMIC_DRAW);
-        DrawGrid(shaderProgram, gridVAO, gridVertices.size());
+        //update positions
+        if (replaying) {
+            if (!replayPaused) replayHead += replaySpeed * 60.0 * deltaTime;
+            ApplyReplayFrame(objs);
+        } else if(!pause){
+            StepWarp(objs);
+        }
+        // the CPU copy behind the grid and picking, see GpuPhysics
+        if (GpuStepping() && (inspecting || ++framesSinceSync >= gpuSyncFrames)) {
+            gpu.Pull(objs);
+            framesSinceSync = 0;
+        }
+        UpdateHover(window);
 
-        // Draw the triangles / sphere
         for(auto& obj : objs) {
-            glUniform4f(objectColorLoc, obj.color.r, obj.color.g, obj.color.b, obj.color.a);
-
-            for(auto& obj2 : objs){
-                if(&obj2 != &obj && !obj.Initalizing && !obj2.Initalizing){
-                    float dx = obj2.GetPos()[0] - obj.GetPos()[0];
-                    float dy = obj2.GetPos()[1] - obj.GetPos()[1];
-                    float dz = obj2.GetPos()[2] - obj.GetPos()[2];
-                    float distance = sqrt(dx * dx + dy * dy + dz * dz);
-
-                    if (distance > 0) {
-                        std::vector<float> direction = {dx / distance, dy / distance, dz / distance};
-                        distance *= 1000;
-                        double Gforce = (G * obj.mass * obj2.mass) / (distance * distance);
-                        
-
-                        float acc1 = Gforce / obj.mass;
-                        std::vector<float> acc = {direction[0] * acc1, direction[1]*acc1, direction[2]*acc1};
-                        if(!pause){
-                            obj.accelerate(acc[0], acc[1], acc[2]);
-                        }
-
-                        //collision
-                        obj.velocity *= obj.CheckCollision(obj2);
-                        std::cout<<"radius: "<<obj.radius<<std::endl;
-                    }
-                }
-            }
             if(obj.Initalizing){
                 obj.radius = pow(((3 * obj.mass/obj.density)/(4 * 3.14159265359)), (1.0f/3.0f)) / 1000000;
                 obj.UpdateVertices();
             }
-
-            //update positions
-            if(!pause){
-                obj.UpdatePos();
-            }
-            
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, obj.position); // apply position
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-            glUniform1i(glGetUniformLocation(shaderProgram, "isGrid"), 0);
-            if(obj.glow){
-                glUniform1i(glGetUniformLocation(shaderProgram, "GLOW"), 1);
-            } else {
-                glUniform1i(glGetUniformLocation(shaderProgram, "GLOW"), 0);
-            }
-            
-            glBindVertexArray(obj.VAO);
-            glDrawArrays(GL_TRIANGLES, 0, obj.vertexCount / 3);
+        }
+        // the GPU path draws its own buffers, which hold only the latest state
+        bool blend = renderAlpha < 1.0f && !GpuStepping();
+        if (blend) InterpolatePositions(objs);
+        uint64_t renderStart = metrics.Start(true);
+        DrawScene(shaderProgram, gridVertices);
+        metrics.Lap(Metrics::Render, renderStart, 1);
+        if (blend) RestorePositions(objs);
+        if (metrics.enabled) {
+            Metrics::Add(metrics.frames, 1);
+            metrics.bodies.store(objs.size(), std::memory_order_relaxed);
         }
         
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
-    for (auto& obj : objs) {
-        glDeleteVertexArrays(1, &obj.VAO);
-        glDeleteBuffers(1, &obj.VBO);
-    }
-
     glDeleteVertexArrays(1, &gridVAO);
     glDeleteBuffers(1, &gridVBO);
 
@@ -388,6 +4288,38 @@ GLuint CreateShaderProgram(const char* vertexSource, const char* fragmentSource)
 
     return shaderProgram;
 }
+// header (#version and defines) and source as two strings; 0 if it does not build
+GLuint CreateComputeProgram(const char* header, const char* source) {
+    const char* sources[2] = { header, source };
+    GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(computeShader, 2, sources, nullptr);
+    glCompileShader(computeShader);
+
+    GLint success;
+    glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetShaderInfoLog(computeShader, 512, nullptr, infoLog);
+        std::cerr << "Compute shader compilation failed: " << infoLog << std::endl;
+        glDeleteShader(computeShader);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, computeShader);
+    glLinkProgram(program);
+    glDeleteShader(computeShader);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetProgramInfoLog(program, 512, nullptr, infoLog);
+        std::cerr << "Compute program linking failed: " << infoLog << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
 void CreateVBOVAO(GLuint& VAO, GLuint& VBO, const float* vertices, size_t vertexCount) {
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
@@ -409,73 +4341,168 @@ void UpdateCam(GLuint shaderProgram, glm::vec3 cameraPos) {
 }
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
-    float cameraSpeed = 10000.0f * deltaTime;
-    bool shiftPressed = (mods & GLFW_MOD_SHIFT) != 0;
-    Object& lastObj = objs[objs.size() - 1];
-    
-
-    if (glfwGetKey(window, GLFW_KEY_W)==GLFW_PRESS){
-        cameraPos += cameraSpeed * cameraFront;
-    }
-    if (glfwGetKey(window, GLFW_KEY_S)==GLFW_PRESS){
-        cameraPos -= cameraSpeed * cameraFront;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_A)==GLFW_PRESS){
-        cameraPos -= cameraSpeed * glm::normalize(glm::cross(cameraFront, cameraUp));
-    }
-    if (glfwGetKey(window, GLFW_KEY_D)==GLFW_PRESS){
-        cameraPos += cameraSpeed * glm::normalize(glm::cross(cameraFront, cameraUp));
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS){
-        cameraPos += cameraSpeed * cameraUp;
-    }
-    if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS){
-        cameraPos -= cameraSpeed * cameraUp;
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS){
-        pause = true;
-    }
-    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_RELEASE){
-        pause = false;
-    }
-    
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS){
-        glfwTerminate();
-        glfwWindowShouldClose(window);
-        running = false;
-    }
+    input.Key(key, action, mods, glfwGetTime());
+}
 
-    // init arrows pos up down left right
-    if(!objs.empty() && objs[objs.size() - 1].Initalizing){
-        if (key == GLFW_KEY_UP && (action == GLFW_PRESS || action == GLFW_REPEAT)){
-            if (!shiftPressed) {
-                objs[objs.size()-1].position[1] += objs[objs.size() - 1].radius * 0.2;
+// one queued action, in the order they happened
+void ApplyAction(GLFWwindow* window, const InputEvent& e) {
+    bool pressed = e.state == GLFW_PRESS;
+    bool repeating = pressed || e.state == GLFW_REPEAT;
+    Object* placed = registry.Get(placing);
+    switch (e.action) {
+        // time warp: - halves, = doubles, 0 back to one step per frame
+        case Action::WarpSlower:
+        case Action::WarpFaster:
+        case Action::WarpReset: {
+            if (replaying || !repeating) break;
+            int warp = e.action == Action::WarpSlower ? std::max(1, warpSteps / 2)
+                     : e.action == Action::WarpFaster ? std::min(maxWarpSteps, warpSteps * 2) : 1;
+            if (warp != warpSteps) {
+                warpSteps = warp;
+                std::cout<<"time warp: "<<warpSteps<<" steps/frame"<<std::endl;
             }
-        };
-        if (key == GLFW_KEY_DOWN && (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-            if (!shiftPressed) {
-                objs[objs.size()-1].position[1] -= objs[objs.size() - 1].radius * 0.2;
+            break;
+        }
+        // H toggles the hover inspector
+        case Action::ToggleInspector:
+            if (!pressed) break;
+            inspecting = !inspecting;
+            if (!inspecting) glfwSetWindowTitle(window, "3D_TEST");
+            break;
+        // E starts and stops the emitter
+        case Action::ToggleEmitter:
+            if (pressed) emitter.active = !emitter.active;
+            break;
+        // B turns the HDR bloom pass off and back on
+        case Action::ToggleBloom:
+            if (pressed) bloom = !bloom;
+            break;
+        // I switches between sphere meshes and ray-cast impostors
+        case Action::ToggleImpostors:
+            if (pressed) impostors = !impostors;
+            break;
+        // C turns frustum culling, grid chunking and point sprites off for comparison
+        case Action::ToggleCulling:
+            if (pressed) culling = !culling;
+            break;
+        // G swaps the uniform grid for the adaptive one and back
+        case Action::ToggleGrid:
+            if (pressed) adaptiveGrid = !adaptiveGrid;
+            break;
+        // cycle force law: newtonian -> plummer -> spline -> 1PN
+        case Action::CycleForceLaw:
+            if (!pressed) break;
+            forceLaw = ForceLaw((int(forceLaw) + 1) % 4);
+            stepKernel = SelectStepKernel(forceLaw, unitSystem, deterministic, keplerMode, lodPhysics);
+            std::cout<<"force law: "<<int(forceLaw)<<std::endl;
+            break;
+        // R switches the close-encounter sub-integrator on and off
+        case Action::ToggleEncounters:
+            if (!pressed) break;
+            if (lodPhysics) {
+                std::cout<<"encounters: not available with --lod"<<std::endl;
+                break;
+            }
+            encounters = !encounters;
+            std::cout<<"encounters: "<<(encounters ? "on" : "off")<<std::endl;
+            break;
+        // O switches the hybrid Kepler integrator on and off
+        case Action::ToggleKepler:
+            if (!pressed) break;
+            if (lodPhysics) {
+                std::cout<<"kepler mode: not available with --lod"<<std::endl;
+                break;
             }
+            keplerMode = !keplerMode;
+            stepKernel = SelectStepKernel(forceLaw, unitSystem, deterministic, keplerMode, lodPhysics);
+            std::cout<<"kepler mode: "<<(keplerMode ? "on" : "off")<<std::endl;
+            break;
+        // replay transport: P play/pause, [ ] half/double speed, , . step a frame, HOME END seek
+        case Action::ReplayPlay:
+            if (replaying && pressed) replayPaused = !replayPaused;
+            break;
+        case Action::ReplaySlower:
+            if (replaying && repeating) replaySpeed *= 0.5;
+            break;
+        case Action::ReplayFaster:
+            if (replaying && repeating) replaySpeed *= 2.0;
+            break;
+        case Action::ReplayBack:
+            if (replaying && repeating) { replayPaused = true; replayHead = std::floor(replayHead) - 1.0; }
+            break;
+        case Action::ReplayForward:
+            if (replaying && repeating) { replayPaused = true; replayHead = std::floor(replayHead) + 1.0; }
+            break;
+        case Action::ReplayStart:
+            if (replaying && repeating) replayHead = 0.0;
+            break;
+        case Action::ReplayEnd:
+            if (replaying && repeating) replayHead = double(replay.FrameCount() - 1);
+            break;
+        case Action::Quit:
+            if (!pressed) break;
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+            running = false;
+            break;
+        // arrows move the body being placed (up/down also lift it unless shift is held), DELETE drops it
+        case Action::NudgeUp:
+        case Action::NudgeDown: {
+            if (!placed || !repeating) break;
+            float step = (e.action == Action::NudgeUp ? 0.2f : -0.2f) * placed->radius;
+            if (!(e.mods & GLFW_MOD_SHIFT)) placed->position[1] += step;
+            placed->position[2] += step;
+            break;
         }
-        if(key == GLFW_KEY_RIGHT && (action == GLFW_PRESS || action == GLFW_REPEAT)){
-            objs[objs.size()-1].position[0] += objs[objs.size() - 1].radius * 0.2;
-        };
-        if(key == GLFW_KEY_LEFT && (action == GLFW_PRESS || action == GLFW_REPEAT)){
-            objs[objs.size()-1].position[0] -= objs[objs.size() - 1].radius * 0.2;
-        };
-        if (key == GLFW_KEY_UP && (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-            objs[objs.size()-1].position[2] += objs[objs.size() - 1].radius * 0.2;
-        };
+        case Action::NudgeLeft:
+        case Action::NudgeRight:
+            if (placed && repeating) placed->position[0] += (e.action == Action::NudgeRight ? 0.2f : -0.2f) * placed->radius;
+            break;
+        case Action::Drop:
+            if (placed && pressed) registry.Remove(placing);
+            break;
+        // middle click prints the hovered body's full report
+        case Action::Inspect:
+            if (!pressed) break;
+            if (Object* obj = registry.Get(hovered)) Inspect(objs, size_t(obj - objs.data()), std::cout, false);
+            break;
+        // left button: press spawns a body at the origin, release launches it
+        case Action::Place:
+            if (replaying) break;
+            if (pressed) {
+                placing = registry.Insert(Object(glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0f, 0.0f, 0.0f), initMass));
+                registry.Get(placing)->Initalizing = true;
+            } else if (e.state == GLFW_RELEASE) {
+                if (placed) {
+                    placed->Initalizing = false;
+                    placed->Launched = true;
+                }
+                placing = BodyHandle();
+            }
+            break;
+        // right button: a 20% jump in mass per click, and the main loop grows it while held
+        case Action::Grow:
+            if (replaying || !placed || !placed->Initalizing || !repeating) break;
+            placed->mass *= 1.2;
+            std::cout<<"MASS: "<<placed->mass<<std::endl;
+            break;
+        default:
+            break;
+    }
+}
 
-        if (key == GLFW_KEY_DOWN && (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-            objs[objs.size()-1].position[2] -= objs[objs.size() - 1].radius * 0.2;
-        }
-    };
-    
-};
+void HandleInput(GLFWwindow* window, double now) {
+    input.Begin(now);
+    // K is held to pause; the start-up pause lasts until the first key
+    if (!input.Events().empty()) pause = input.Held(Action::Pause);
+    for (const InputEvent& e : input.Events()) ApplyAction(window, e);
+
+    // world units per second of holding the key
+    const float cameraSpeed = 10000.0f;
+    glm::vec3 right = glm::normalize(glm::cross(cameraFront, cameraUp));
+    cameraPos += cameraSpeed * float(input.HeldFor(Action::Forward) - input.HeldFor(Action::Back)) * cameraFront;
+    cameraPos += cameraSpeed * float(input.HeldFor(Action::Right) - input.HeldFor(Action::Left)) * right;
+    cameraPos += cameraSpeed * float(input.HeldFor(Action::Up) - input.HeldFor(Action::Down)) * cameraUp;
+}
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
 
     float xoffset = xpos - lastX;
@@ -499,23 +4526,9 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
     cameraFront = glm::normalize(front);
 }
-void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods){s
-    if (button == GLFW_MOUSE_BUTTON_LEFT){
-        if (action == GLFW_PRESS){
-            objs.emplace_back(glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0f, 0.0f, 0.0f), initMass);
-            objs[objs.size()-1].Initalizing = true;
-        };
-        if (action == GLFW_RELEASE){
-            objs[objs.size()-1].Initalizing = false;
-            objs[objs.size()-1].Launched = true;
-        };
-    };
-    if (!objs.empty() && button == GLFW_MOUSE_BUTTON_RIGHT && objs[objs.size()-1].Initalizing) {
-        if (action == GLFW_PRESS || action == GLFW_REPEAT) {
-            objs[objs.size()-1].mass *= 1.2;}
-            std::cout<<"MASS: "<<objs[objs.size()-1].mass<<std::endl;
-    }
-};
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods){
+    input.Button(button, action, mods, glfwGetTime());
+}
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset){
     float cameraSpeed = 250000.0f * deltaTime;
     if(yoffset>0){
@@ -531,6 +4544,539 @@ glm::vec3 sphericalToCartesian(float r, float theta, float phi){
     float z = r * sin(theta) * sin(phi);
     return glm::vec3(x, y, z);
 };
+// adaptive curvature grid: a quadtree over the grid square, refined where the warp is not
+// well approximated by straight segments (centre vs corner-average error) and collapsed again
+// when bodies move away. The tolerance floats so the line vertices stay near gridVertexBudget.
+
+class AdaptiveGrid {
+    public:
+        float size = 20000.0f;
+        int maxDepth = 9;
+        float tolerance = 5.0f;     // world units of vertical error per cell
+
+        void Update(const std::vector<Object>& objs) {
+            if (nodes.empty()) {
+                nodes.push_back({ -size / 2.0f, -size / 2.0f, size, 0, -1, -1 });
+            }
+            sources.clear();
+            double totalMass = 0.0, comY = 0.0;
+            for (const auto& obj : objs) {
+                if (obj.Initalizing) continue;
+                sources.push_back({ obj.position, float((2 * G * obj.mass) / (c * c)) });
+                comY += obj.mass * obj.position.y;
+                totalMass += obj.mass;
+            }
+            planeY = totalMass > 0.0 ? float(comY / totalMass) : 0.0f;
+            Refine(0);
+        }
+
+        // line-segment vertices for GL_LINES, same layout as CreateGridVertices
+        void Emit(std::vector<float>& vertices) {
+            vertices.clear();
+            float half = size / 2.0f;
+            float maxWarp = std::max(Warp(-half, -half), std::max(Warp(half, half), std::max(Warp(-half, half), Warp(half, -half))));
+            for (size_t i = 0; i < nodes.size(); ++i) {
+                const Node& n = nodes[i];
+                if (n.child >= 0 || n.size == 0.0f) continue;
+                // left and bottom edges, plus the outer border; split where the neighbour is finer
+                EmitEdge(vertices, n.x, n.z, 0.0f, 1.0f, n.size, -1.0f, 0.0f, maxWarp);
+                EmitEdge(vertices, n.x, n.z, 1.0f, 0.0f, n.size, 0.0f, -1.0f, maxWarp);
+                if (n.x + n.size >= half) EmitEdge(vertices, n.x + n.size, n.z, 0.0f, 1.0f, n.size, 0.0f, 0.0f, maxWarp);
+                if (n.z + n.size >= half) EmitEdge(vertices, n.x, n.z + n.size, 1.0f, 0.0f, n.size, 0.0f, 0.0f, maxWarp);
+            }
+            // steer the tolerance toward the vertex budget
+            size_t count = vertices.size() / 3;
+            if (count > size_t(gridVertexBudget)) tolerance *= 1.25f;
+            else if (count < size_t(gridVertexBudget) / 2) tolerance = std::max(0.01f, tolerance * 0.8f);
+        }
+
+    private:
+        struct Node {
+            float x, z, size;   // min corner and edge length, size 0 marks a free slot
+            int depth;
+            int child;          // first of four consecutive children, -1 for a leaf
+            int parent;
+        };
+        struct Source {
+            glm::vec3 position;
+            float rs;
+        };
+        std::vector<Node> nodes;
+        std::vector<int> freeBlocks;    // first index of unused groups of four
+        std::vector<Source> sources;
+        float planeY = 0.0f;
+
+        // same profile as UpdateGridVertices: 2 * sqrt(rs (r - rs)) per body, doubled
+        float Warp(float x, float z) const {
+            glm::vec3 p(x, planeY, z);
+            float w = 0.0f;
+            for (const auto& s : sources) {
+                float distance_m = glm::length(s.position - p) * 1000.0f;
+                w += 4.0f * std::sqrt(std::max(s.rs * (distance_m - s.rs), 0.0f));
+            }
+            return w;
+        }
+
+        bool NeedsSplit(const Node& n) const {
+            if (n.depth >= maxDepth) return false;
+            float s = n.size;
+            float corners = 0.25f * (Warp(n.x, n.z) + Warp(n.x + s, n.z) + Warp(n.x, n.z + s) + Warp(n.x + s, n.z + s));
+            return std::abs(Warp(n.x + s / 2.0f, n.z + s / 2.0f) - corners) > tolerance;
+        }
+
+        void Refine(int index) {
+            bool want = NeedsSplit(nodes[index]);
+            if (want && nodes[index].child < 0) {
+                Split(index);
+            } else if (!want && nodes[index].child >= 0) {
+                Collapse(index);
+                return;
+            }
+            int child = nodes[index].child;
+            if (child < 0) return;
+            for (int k = 0; k < 4; ++k) Refine(child + k);
+        }
+
+        void Split(int index) {
+            int child;
+            if (!freeBlocks.empty()) {
+                child = freeBlocks.back();
+                freeBlocks.pop_back();
+            } else {
+                child = int(nodes.size());
+                nodes.resize(nodes.size() + 4);
+            }
+            Node n = nodes[index];
+            float h = n.size / 2.0f;
+            for (int k = 0; k < 4; ++k) {
+                nodes[child + k] = { n.x + (k & 1) * h, n.z + (k >> 1) * h, h, n.depth + 1, -1, index };
+            }
+            nodes[index].child = child;
+        }
+
+        void Collapse(int index) {
+            int child = nodes[index].child;
+            for (int k = 0; k < 4; ++k) {
+                if (nodes[child + k].child >= 0) Collapse(child + k);
+                nodes[child + k].size = 0.0f;
+            }
+            freeBlocks.push_back(child);
+            nodes[index].child = -1;
+        }
+
+        float LeafSizeAt(float x, float z) const {
+            int index = 0;
+            const Node* n = &nodes[0];
+            if (x < n->x || z < n->z || x >= n->x + n->size || z >= n->z + n->size) return n->size;
+            while (n->child >= 0) {
+                float h = n->size / 2.0f;
+                int k = (x >= n->x + h ? 1 : 0) + (z >= n->z + h ? 2 : 0);
+                index = n->child + k;
+                n = &nodes[index];
+            }
+            return n->size;
+        }
+
+        // edge from (x, z) along (dx, dz); (nx, nz) points into the neighbour whose
+        // finer vertices must be matched to avoid cracks, (0, 0) for the border
+        void EmitEdge(std::vector<float>& vertices, float x, float z, float dx, float dz, float length,
+                      float nx, float nz, float maxWarp) const {
+            const float probe = 1e-3f * nodes[0].size / float(1 << maxDepth);
+            float t = 0.0f;
+            float y0 = planeY - (maxWarp - Warp(x, z));
+            while (t < length) {
+                float step = length - t;
+                if (nx != 0.0f || nz != 0.0f) {
+                    step = std::min(step, LeafSizeAt(x + dx * (t + probe) + nx * probe, z + dz * (t + probe) + nz * probe));
+                }
+                float x1 = x + dx * (t + step), z1 = z + dz * (t + step);
+                float y1 = planeY - (maxWarp - Warp(x1, z1));
+                vertices.insert(vertices.end(), { x + dx * t, y0, z + dz * t, x1, y1, z1 });
+                y0 = y1;
+                t += step;
+            }
+        }
+};
+AdaptiveGrid adaptive;
+
+// view frustum planes pulled out of projection * view (Gribb & Hartmann), normals point inward
+struct Frustum {
+    glm::vec4 planes[6];
+
+    explicit Frustum(const glm::mat4& m) {
+        // glm is column-major, row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; ++i) rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+        for (int i = 0; i < 3; ++i) {
+            planes[2 * i] = rows[3] + rows[i];
+            planes[2 * i + 1] = rows[3] - rows[i];
+        }
+        for (auto& p : planes) p /= glm::length(glm::vec3(p));
+    }
+    bool Sphere(const glm::vec3& c, float r) const {
+        for (const auto& p : planes) {
+            if (glm::dot(glm::vec3(p), c) + p.w < -r) return false;
+        }
+        return true;
+    }
+    bool Box(const glm::vec3& lo, const glm::vec3& hi) const {
+        for (const auto& p : planes) {
+            // the corner furthest along the plane normal
+            glm::vec3 v(p.x > 0 ? hi.x : lo.x, p.y > 0 ? hi.y : lo.y, p.z > 0 ? hi.z : lo.z);
+            if (glm::dot(glm::vec3(p), v) + p.w < 0) return false;
+        }
+        return true;
+    }
+};
+
+// grid line segments bucketed by the xz cell of their midpoint, so whole off-screen chunks are skipped
+class GridChunks {
+    public:
+        static const int cells = 8;
+        GLint first[cells * cells];     // in vertices
+        GLsizei count[cells * cells];
+        glm::vec3 lo[cells * cells], hi[cells * cells];
+
+        // stable counting sort of the segments in place; an already bucketed grid stays put
+        void Build(std::vector<float>& vertices) {
+            size_t segments = vertices.size() / 6;
+            glm::vec2 mn(std::numeric_limits<float>::max()), mx(-std::numeric_limits<float>::max());
+            for (size_t i = 0; i < segments; ++i) {
+                const float* v = &vertices[i * 6];
+                glm::vec2 mid(v[0] + v[3], v[2] + v[5]);
+                mn = glm::min(mn, mid * 0.5f);
+                mx = glm::max(mx, mid * 0.5f);
+            }
+            glm::vec2 scale = float(cells) / glm::max(mx - mn, glm::vec2(1e-3f));
+
+            cellOf.resize(segments);
+            std::fill(count, count + cells * cells, 0);
+            for (size_t i = 0; i < segments; ++i) {
+                const float* v = &vertices[i * 6];
+                glm::vec2 mid = glm::vec2(v[0] + v[3], v[2] + v[5]) * 0.5f;
+                int cx = std::min(cells - 1, int((mid.x - mn.x) * scale.x));
+                int cz = std::min(cells - 1, int((mid.y - mn.y) * scale.y));
+                cellOf[i] = cz * cells + cx;
+                count[cellOf[i]] += 2;
+            }
+            GLint at = 0;
+            for (int c = 0; c < cells * cells; ++c) {
+                first[c] = at;
+                at += count[c];
+                lo[c] = glm::vec3(std::numeric_limits<float>::max());
+                hi[c] = glm::vec3(-std::numeric_limits<float>::max());
+            }
+
+            scratch.resize(vertices.size());
+            GLint cursor[cells * cells];
+            std::copy(first, first + cells * cells, cursor);
+            for (size_t i = 0; i < segments; ++i) {
+                int c = cellOf[i];
+                const float* v = &vertices[i * 6];
+                std::copy(v, v + 6, &scratch[size_t(cursor[c]) * 3]);
+                cursor[c] += 2;
+                glm::vec3 a(v[0], v[1], v[2]), b(v[3], v[4], v[5]);
+                lo[c] = glm::min(lo[c], glm::min(a, b));
+                hi[c] = glm::max(hi[c], glm::max(a, b));
+            }
+            vertices.swap(scratch);
+        }
+
+    private:
+        std::vector<int> cellOf;
+        std::vector<float> scratch;
+};
+GridChunks gridChunks;
+
+// HDR scene target plus a quarter-resolution bloom chain:
+// Begin() redirects drawing into a float framebuffer, End() bright-passes it down to a
+// quarter, blurs it there and tone maps scene + bloom into whatever was bound before
+class Bloom {
+    public:
+        bool Begin() {
+            glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            if (viewport[2] != width || viewport[3] != height) Resize(viewport[2], viewport[3]);
+            if (!ok) return false;
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+            glViewport(0, 0, width, height);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            return true;
+        }
+        void End() {
+            glDisable(GL_DEPTH_TEST);
+            glDisable(GL_BLEND);
+            glBindVertexArray(emptyVAO);
+
+            int halfW = std::max(1, width / 2), halfH = std::max(1, height / 2);
+            int quarterW = std::max(1, width / 4), quarterH = std::max(1, height / 4);
+            glUseProgram(brightProgram);
+            Pass(fbo[0], halfW, halfH, sceneColor);
+            glUniform2f(glGetUniformLocation(brightProgram, "texel"), 1.0f / width, 1.0f / height);
+            glUniform1f(glGetUniformLocation(brightProgram, "threshold"), bloomThreshold);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            Pass(fbo[1], quarterW, quarterH, tex[0]);
+            glUniform2f(glGetUniformLocation(brightProgram, "texel"), 1.0f / halfW, 1.0f / halfH);
+            glUniform1f(glGetUniformLocation(brightProgram, "threshold"), 0.0f);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            // two separable passes ping-ponging between the quarter targets
+            glUseProgram(blurProgram);
+            for (int i = 0; i < 2; ++i) {
+                Pass(fbo[2], quarterW, quarterH, tex[1]);
+                glUniform2f(glGetUniformLocation(blurProgram, "direction"), 1.0f / quarterW, 0.0f);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+                Pass(fbo[1], quarterW, quarterH, tex[2]);
+                glUniform2f(glGetUniformLocation(blurProgram, "direction"), 0.0f, 1.0f / quarterH);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            }
+
+            glUseProgram(compositeProgram);
+            glBindFramebuffer(GL_FRAMEBUFFER, previous);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, sceneColor);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, tex[1]);
+            glUniform1i(glGetUniformLocation(compositeProgram, "scene"), 0);
+            glUniform1i(glGetUniformLocation(compositeProgram, "bloom"), 1);
+            glUniform1f(glGetUniformLocation(compositeProgram, "bloomStrength"), bloomStrength);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glActiveTexture(GL_TEXTURE0);
+
+            glBindVertexArray(0);
+            glEnable(GL_DEPTH_TEST);
+            glEnable(GL_BLEND);
+        }
+
+    private:
+        GLuint sceneFBO = 0, sceneColor = 0, sceneDepth = 0;
+        GLuint fbo[3] = {}, tex[3] = {};    // half, quarter ping, quarter pong
+        GLuint emptyVAO = 0, brightProgram = 0, blurProgram = 0, compositeProgram = 0;
+        int width = 0, height = 0;
+        bool ok = false;
+        GLint previous = 0;
+        GLint viewport[4];
+
+        static void Target(GLuint& fbo, GLuint& tex, int w, int h) {
+            if (tex == 0) glGenTextures(1, &tex);
+            glBindTexture(GL_TEXTURE_2D, tex);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            if (fbo == 0) glGenFramebuffers(1, &fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+        }
+        void Resize(int w, int h) {
+            if (emptyVAO == 0) {
+                glGenVertexArrays(1, &emptyVAO);
+                brightProgram = CreateShaderProgram(fullscreenVertexShaderSource, brightFragmentShaderSource);
+                blurProgram = CreateShaderProgram(fullscreenVertexShaderSource, blurFragmentShaderSource);
+                compositeProgram = CreateShaderProgram(fullscreenVertexShaderSource, compositeFragmentShaderSource);
+            }
+            width = w;
+            height = h;
+            ok = false;
+            if (w <= 0 || h <= 0) return;
+            Target(fbo[0], tex[0], std::max(1, w / 2), std::max(1, h / 2));
+            Target(fbo[1], tex[1], std::max(1, w / 4), std::max(1, h / 4));
+            Target(fbo[2], tex[2], std::max(1, w / 4), std::max(1, h / 4));
+            Target(sceneFBO, sceneColor, w, h);
+            if (sceneDepth == 0) glGenRenderbuffers(1, &sceneDepth);
+            glBindRenderbuffer(GL_RENDERBUFFER, sceneDepth);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sceneDepth);
+            ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+            if (!ok) std::cerr << "HDR framebuffer incomplete, bloom disabled." << std::endl;
+            glBindFramebuffer(GL_FRAMEBUFFER, previous);
+        }
+        void Pass(GLuint target, int w, int h, GLuint source) {
+            glBindFramebuffer(GL_FRAMEBUFFER, target);
+            glViewport(0, 0, w, h);
+            glBindTexture(GL_TEXTURE_2D, source);
+        }
+};
+Bloom bloomPass;
+
+// grid warp plus sphere draws for the current state, shared by the window and the offscreen recorder
+void DrawScene(GLuint shaderProgram, std::vector<float>& gridVertices) {
+    GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
+    GLint objectColorLoc = glGetUniformLocation(shaderProgram, "objectColor");
+
+    // whoever set up the camera (window or recorder) left view and projection on the program
+    glUseProgram(shaderProgram);
+    glm::mat4 view, projection;
+    glGetUniformfv(shaderProgram, glGetUniformLocation(shaderProgram, "view"), glm::value_ptr(view));
+    glGetUniformfv(shaderProgram, glGetUniformLocation(shaderProgram, "projection"), glm::value_ptr(projection));
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glm::mat4 viewProjection = projection * view;
+    Frustum frustum(viewProjection);
+    bool hdr = bloom && bloomPass.Begin();
+
+    // Draw the grid
+    glUseProgram(shaderProgram);
+    glUniform1f(glGetUniformLocation(shaderProgram, "glowIntensity"), glowIntensity);
+    glUniform4f(objectColorLoc, 1.0f, 1.0f, 1.0f, 0.25f);
+    glUniform1i(glGetUniformLocation(shaderProgram, "isGrid"), 1);
+    glUniform1i(glGetUniformLocation(shaderProgram, "GLOW"), 0);
+    static bool wasAdaptive = false;
+    if (adaptiveGrid) {
+        adaptive.Update(objs);
+        adaptive.Emit(gridVertices);
+    } else {
+        // back from the adaptive mesh: start over from the flat uniform grid
+        if (wasAdaptive) gridVertices = CreateGridVertices(20000.0f, 25, objs);
+        UpdateGridVertices(gridVertices, objs);
+    }
+    wasAdaptive = adaptiveGrid;
+    if (culling) gridChunks.Build(gridVertices);
+    glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
+    glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(float), gridVertices.data(), GL_DYNAMIC_DRAW);
+    if (culling) {
+        GLint first[GridChunks::cells * GridChunks::cells];
+        GLsizei count[GridChunks::cells * GridChunks::cells];
+        GLsizei visible = 0;
+        for (int c = 0; c < GridChunks::cells * GridChunks::cells; ++c) {
+            if (gridChunks.count[c] == 0 || !frustum.Box(gridChunks.lo[c], gridChunks.hi[c])) continue;
+            first[visible] = gridChunks.first[c];
+            count[visible] = gridChunks.count[c];
+            ++visible;
+        }
+        glm::mat4 model = glm::mat4(1.0f);
+        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+        glBindVertexArray(gridVAO);
+        glMultiDrawArrays(GL_LINES, first, count, visible);
+        glBindVertexArray(0);
+    } else {
+        DrawGrid(shaderProgram, gridVAO, gridVertices.size());
+    }
+
+    // Draw the triangles / sphere, off-screen bodies are skipped and small ones become sprites:
+    // flat points under spritePixels, or ray-cast impostors up to the largest point size
+    struct Sprite {
+        glm::vec4 sphere;
+        uint8_t color[4];
+    };
+    static std::vector<Sprite> sprites, glowing;
+    static GLuint sphereVAO = 0, sphereVBO = 0;
+    static size_t sphereVertexCount = 0;
+    if (sphereVAO == 0) {
+        std::vector<float> sphere = Object::Draw();
+        sphereVertexCount = sphere.size();
+        CreateVBOVAO(sphereVAO, sphereVBO, sphere.data(), sphereVertexCount);
+    }
+    static float maxPointSize = 0.0f;
+    if (maxPointSize == 0.0f) {
+        GLfloat range[2] = {1.0f, 64.0f};
+        glGetFloatv(GL_POINT_SIZE_RANGE, range);
+        maxPointSize = std::max(range[1], 1.0f);
+    }
+    sprites.clear();
+    glowing.clear();
+    if (GpuStepping()) {
+        // the bodies never leave the GPU, see GpuPhysics
+        gpu.Push(objs);
+        gpu.Draw(view, projection, sphereVBO, GLsizei(sphereVertexCount / 3));
+        glUseProgram(shaderProgram);
+    } else {
+        for(auto& obj : objs) {
+            if ((culling || impostors) && !obj.Initalizing) {
+                if (culling && !frustum.Sphere(obj.position, obj.radius)) continue;
+                float w = (viewProjection * glm::vec4(obj.position, 1.0f)).w;
+                float pixels = obj.radius * projection[1][1] * 0.5f * float(viewport[3]) / std::max(w, 1e-3f);
+                // glow halos are four diameters (eight radii) across
+                float limit = impostors ? (obj.glow ? 0.125f : 0.5f) * maxPointSize - 1.0f : spritePixels;
+                if (pixels < limit) {
+                    Sprite sprite;
+                    sprite.sphere = glm::vec4(obj.position, obj.radius);
+                    glm::vec4 color = obj.target ? glm::vec4(1.0f) : obj.color;
+                    for (int k = 0; k < 4; ++k) sprite.color[k] = uint8_t(glm::clamp(color[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+                    (impostors && obj.glow ? glowing : sprites).push_back(sprite);
+                    continue;
+                }
+            }
+            obj.EnsureMesh();
+            // the hovered body is drawn white
+            glm::vec4 color = obj.target ? glm::vec4(1.0f) : obj.color;
+            glUniform4f(objectColorLoc, color.r, color.g, color.b, color.a);
+            glm::mat4 model = glm::mat4(1.0f);
+            model = glm::translate(model, obj.position); // apply position
+            model = glm::scale(model, glm::vec3(obj.meshRadius));
+            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+            glUniform1i(glGetUniformLocation(shaderProgram, "isGrid"), 0);
+            if(obj.glow){
+                glUniform1i(glGetUniformLocation(shaderProgram, "GLOW"), 1);
+            } else {
+                glUniform1i(glGetUniformLocation(shaderProgram, "GLOW"), 0);
+            }
+        
+            glBindVertexArray(sphereVAO);
+            glDrawArrays(GL_TRIANGLES, 0, GLsizei(sphereVertexCount / 3));
+        }
+    }
+
+    if (!sprites.empty() || !glowing.empty()) {
+        static GLuint pointProgram = CreateShaderProgram(pointVertexShaderSource, pointFragmentShaderSource);
+        static GLuint impostorProgram = CreateShaderProgram(impostorVertexShaderSource, impostorFragmentShaderSource);
+        static GLuint spriteVAO = 0, spriteVBO = 0;
+        if (spriteVAO == 0) {
+            glGenVertexArrays(1, &spriteVAO);
+            glGenBuffers(1, &spriteVBO);
+            glBindVertexArray(spriteVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, spriteVBO);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Sprite), (void*)0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Sprite), (void*)offsetof(Sprite, color));
+            glEnableVertexAttribArray(1);
+        }
+        // lit bodies first, then the glowing ones on top of them
+        GLsizei lit = GLsizei(sprites.size());
+        sprites.insert(sprites.end(), glowing.begin(), glowing.end());
+        glBindVertexArray(spriteVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, spriteVBO);
+        glBufferData(GL_ARRAY_BUFFER, sprites.size() * sizeof(Sprite), sprites.data(), GL_STREAM_DRAW);
+
+        GLuint program = impostors ? impostorProgram : pointProgram;
+        glUseProgram(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        if (impostors) {
+            glm::vec3 lightPos = glm::vec3(view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+            glUniform3fv(glGetUniformLocation(program, "lightPos"), 1, glm::value_ptr(lightPos));
+            glUniform2f(glGetUniformLocation(program, "viewportSize"), float(viewport[2]), float(viewport[3]));
+            glUniform1f(glGetUniformLocation(program, "viewportHeight"), float(viewport[3]));
+            glEnable(GL_PROGRAM_POINT_SIZE);
+            glUniform1f(glGetUniformLocation(program, "glowIntensity"), glowIntensity);
+            glUniform1f(glGetUniformLocation(program, "haloScale"), 1.0f);
+            glUniform1i(glGetUniformLocation(program, "GLOW"), 0);
+            glDrawArrays(GL_POINTS, 0, lit);
+            if (!glowing.empty()) {
+                // additive, tested against the depth of the lit bodies but not written
+                glUniform1f(glGetUniformLocation(program, "haloScale"), 4.0f);
+                glUniform1i(glGetUniformLocation(program, "GLOW"), 1);
+                glDepthMask(GL_FALSE);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+                glDrawArrays(GL_POINTS, lit, GLsizei(glowing.size()));
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                glDepthMask(GL_TRUE);
+            }
+            glDisable(GL_PROGRAM_POINT_SIZE);
+        } else {
+            glPointSize(spritePixels);
+            glDrawArrays(GL_POINTS, 0, lit);
+        }
+        glUseProgram(shaderProgram);
+    }
+    glBindVertexArray(0);
+    if (hdr) {
+        bloomPass.End();
+        glUseProgram(shaderProgram);
+    }
+}
 void DrawGrid(GLuint shaderProgram, GLuint gridVAO, size_t vertexCount) {
     glUseProgram(shaderProgram);
     glm::mat4 model = glm::mat4(1.0f); // Identity matrix for the grid
@@ -578,7 +5124,7 @@ std::vector<float> CreateGridVertices(float size, int divisions, const std::vect
 
     return vertices;
 }
-std::vector<float> UpdateGridVertices(std::vector<float> vertices, const std::vector<Object>& objs){
+void UpdateGridVertices(std::vector<float>& vertices, const std::vector<Object>& objs){
     
     // centre of mass calc
     float totalMass = 0.0f;
@@ -596,7 +5142,6 @@ std::vector<float> UpdateGridVertices(std::vector<float> vertices, const std::ve
     }
 
     float verticalShift = comY - originalMaxY;
-    std::cout<<"vertical shift: "<<verticalShift<<" |         comY: "<<comY<<"|            originalmaxy: "<<originalMaxY<<std::endl;
 
 
     for (int i = 0; i < vertices.size(); i += 3) {
@@ -617,6 +5162,4 @@ std::vector<float> UpdateGridVertices(std::vector<float> vertices, const std::ve
         }
         vertices[i+1] = totalDisplacement.y + -abs(verticalShift);
     }
-
-    return vertices;
 }
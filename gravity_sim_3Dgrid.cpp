@@ -5,6 +5,7 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
 #include <iostream>
+#include <algorithm>
 
 const char* vertexShaderSource = R"glsl(#version 330 core
 layout(location=0)in vec3 aPos;uniform mat4 model;uniform mat4 view;uniform mat4 projection;
@@ -19,6 +20,62 @@ void main() {
 }
 )glsl";
 
+// 3D lattice, generated entirely in the vertex shader from gl_VertexID: no vertex buffer at all.
+// Segments along x, then z, then y; only y-layers sliceLo..sliceHi are generated.
+const char* latticeVertexShaderSource = R"glsl(
+#version 330 core
+uniform mat4 view;
+uniform mat4 projection;
+uniform int divisions;
+uniform int sliceLo;
+uniform int sliceHi;
+uniform float latticeSize;
+uniform float pullScale;
+uniform int bodyCount;
+uniform vec4 bodies[64]; // xyz position, w = Schwarzschild radius, both in world units (km)
+out float strain;
+void main() {
+    int seg = gl_VertexID / 2;
+    int end = gl_VertexID - seg * 2;
+    int P = divisions + 1;
+    int ny = sliceHi - sliceLo + 1;
+    int nx = divisions * ny * P;
+    ivec3 a;
+    ivec3 dir;
+    if (seg < nx) {
+        int k = seg % P; int t = seg / P;
+        a = ivec3(t / ny, sliceLo + t % ny, k); dir = ivec3(1, 0, 0);
+    } else if (seg < 2 * nx) {
+        seg -= nx;
+        int k = seg % divisions; int t = seg / divisions;
+        a = ivec3(t / ny, sliceLo + t % ny, k); dir = ivec3(0, 0, 1);
+    } else {
+        seg -= 2 * nx;
+        int k = seg % P; int t = seg / P;
+        a = ivec3(t % P, sliceLo + t / P, k); dir = ivec3(0, 1, 0);
+    }
+    vec3 p = (vec3(a + dir * end) / float(divisions) - 0.5) * latticeSize;
+
+    // pull every lattice point toward each body by its weak-field strength rs / d, exaggerated
+    // by pullScale into a fraction of the lattice, never past the body
+    vec3 shift = vec3(0.0);
+    for (int b = 0; b < bodyCount; ++b) {
+        vec3 toBody = bodies[b].xyz - p;
+        float d = length(toBody);
+        if (d > 0.0) shift += toBody / d * min(0.9 * d, pullScale * bodies[b].w / d * latticeSize);
+    }
+    strain = clamp(length(shift) / (latticeSize / float(divisions)), 0.0, 1.0);
+    gl_Position = projection * view * vec4(p + shift, 1.0);
+})glsl";
+
+const char* latticeFragmentShaderSource = R"glsl(
+#version 330 core
+in float strain;
+out vec4 FragColor;
+void main() {
+    FragColor = vec4(mix(vec3(1.0), vec3(1.0, 0.6, 0.2), strain), 0.15 + 0.35 * strain);
+})glsl";
+
 bool running = true;
 bool pause = false;
 glm::vec3 cameraPos   = glm::vec3(0.0f, 0.0f,  1.0f);
@@ -34,6 +91,16 @@ const double G = 6.6743e-11; // m^3 kg^-1 s^-2
 const float c = 299792458.0;
 float initMass = 5.0f * pow(10, 20) / 5;
 
+// L toggles the lattice, -/= density, PAGE_UP/PAGE_DOWN move the slice, [ ] slice thickness.
+// The slice starts as a thin slab through the middle and is kept under latticeVertexBudget.
+bool latticeMode = false;
+int latticeDivisions = 64;
+int sliceLo = 30, sliceHi = 34;
+int latticeVertexBudget = 4000000;
+float latticeSize = 20000.0f;
+// rs / d is ~1e-9 at the Earth's surface, pullScale exaggerates it into a dent a few cells deep
+float pullScale = 5e6f;
+
 GLFWwindow* StartGLU();
 GLuint CreateShaderProgram(const char* vertexSource, const char* fragmentSource);
 void CreateVBOVAO(GLuint& VAO, GLuint& VBO, const float* vertices, size_t vertexCount);
@@ -45,6 +112,7 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 glm::vec3 sphericalToCartesian(float r, float theta, float phi);
 void DrawGrid(GLuint shaderProgram, GLuint gridVAO, size_t vertexCount);
+void DrawLattice(GLuint latticeProgram, GLuint emptyVAO, const glm::mat4& projection);
 
 
 class Object {
@@ -146,7 +214,8 @@ class Object {
 };
 std::vector<Object> objs = {};
 
-std::vector<float> CreateGridVertices(float size, int divisions, const std::vector<Object>& objs);
+std::vector<float> CreateGridVertices(float size, int divisions);
+void UpdateGridVertices(std::vector<float>& vertices, const std::vector<float>& flat, const std::vector<Object>& objs);
 
 GLuint gridVAO, gridVBO; // 100x100 grid with 10 divisions
 
@@ -176,8 +245,18 @@ int main() {
         Object(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), 5.97219*pow(10, 24), 5515),
 
     };
-    std::vector<float> gridVertices = CreateGridVertices(100000.0f, 50, objs);
+    // the flat grid is built once, every frame warps a same-sized copy of it in place
+    const std::vector<float> flatGrid = CreateGridVertices(10000.0f, 50);
+    std::vector<float> gridVertices = flatGrid;
+    UpdateGridVertices(gridVertices, flatGrid, objs);
     CreateVBOVAO(gridVAO, gridVBO, gridVertices.data(), gridVertices.size());
+    glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
+    glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(float), gridVertices.data(), GL_DYNAMIC_DRAW);
+
+    // the lattice has no attributes, but core profile still wants a VAO bound
+    GLuint latticeProgram = CreateShaderProgram(latticeVertexShaderSource, latticeFragmentShaderSource);
+    GLuint emptyVAO;
+    glGenVertexArrays(1, &emptyVAO);
     std::cout<<"Earth radius: "<<objs[1].radius<<std::endl;
     std::cout<<"Moon radius: "<<objs[0].radius<<std::endl;
 
@@ -209,12 +288,17 @@ int main() {
         }
 
         // Draw the grid
+        if (latticeMode) {
+            DrawLattice(latticeProgram, emptyVAO, projection);
+        } else {
+            glUseProgram(shaderProgram);
+            glUniform4f(objectColorLoc, 1.0f, 1.0f, 1.0f, 0.25f); // White color with 50% transparency for the grid
+            UpdateGridVertices(gridVertices, flatGrid, objs);
+            glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, gridVertices.size() * sizeof(float), gridVertices.data());
+            DrawGrid(shaderProgram, gridVAO, gridVertices.size());
+        }
         glUseProgram(shaderProgram);
-        glUniform4f(objectColorLoc, 1.0f, 1.0f, 1.0f, 0.25f); // White color with 50% transparency for the grid
-        gridVertices = CreateGridVertices(10000.0f, 50, objs);
-        glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
-        glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(float), gridVertices.data(), GL_DYNAMIC_DRAW);
-        DrawGrid(shaderProgram, gridVAO, gridVertices.size());
 
         // Draw the triangle
         for(auto& obj : objs) {
@@ -228,13 +312,13 @@ int main() {
                     float distance = sqrt(dx * dx + dy * dy + dz * dz);
 
                     if (distance > 0) {
-                        std::vector<float> direction = {dx / distance, dy / distance, dz / distance};
+                        glm::vec3 direction(dx / distance, dy / distance, dz / distance);
                         distance *= 1000;
                         double Gforce = (G * obj.mass * obj2.mass) / (distance * distance);
                         
 
                         float acc1 = Gforce / obj.mass;
-                        std::vector<float> acc = {direction[0] * acc1, direction[1]*acc1, direction[2]*acc1};
+                        glm::vec3 acc = direction * acc1;
                         if(!pause){
                             obj.accelerate(acc[0], acc[1], acc[2]);
                         }
@@ -272,6 +356,8 @@ int main() {
 
     glDeleteVertexArrays(1, &gridVAO);
     glDeleteBuffers(1, &gridVBO);
+    glDeleteVertexArrays(1, &emptyVAO);
+    glDeleteProgram(latticeProgram);
 
     glDeleteProgram(shaderProgram);
     glfwTerminate();
@@ -406,6 +492,29 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
         pause = false;
     }
     
+    if (action == GLFW_PRESS || action == GLFW_REPEAT){
+        if (key == GLFW_KEY_L && action == GLFW_PRESS) latticeMode = !latticeMode;
+        int thickness = sliceHi - sliceLo;
+        int divisions = latticeDivisions;
+        if (key == GLFW_KEY_EQUAL) latticeDivisions = std::min(latticeDivisions + 8, 512);
+        if (key == GLFW_KEY_MINUS) latticeDivisions = std::max(latticeDivisions - 8, 8);
+        if (latticeDivisions != divisions) {
+            // the slice keeps its place and thickness in world units
+            sliceLo = sliceLo * latticeDivisions / divisions;
+            sliceHi = sliceHi * latticeDivisions / divisions;
+        }
+        if (key == GLFW_KEY_PAGE_UP) { sliceLo += 1; sliceHi += 1; }
+        if (key == GLFW_KEY_PAGE_DOWN) { sliceLo -= 1; sliceHi -= 1; }
+        if (key == GLFW_KEY_RIGHT_BRACKET) sliceHi += 1;
+        if (key == GLFW_KEY_LEFT_BRACKET && thickness > 0) sliceHi -= 1;
+        // keep the slice inside the lattice and its lines (see DrawLattice) inside the vertex budget
+        int P = latticeDivisions + 1;
+        int maxLayers = std::max(1, (latticeVertexBudget / 2 + P * P) / (2 * latticeDivisions * P + P * P));
+        thickness = std::min(std::min(sliceHi - sliceLo, latticeDivisions), maxLayers - 1);
+        sliceLo = std::max(0, std::min(sliceLo, latticeDivisions - thickness));
+        sliceHi = sliceLo + thickness;
+    }
+
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS){
         glfwTerminate();
         glfwWindowShouldClose(window);
@@ -506,7 +615,37 @@ void DrawGrid(GLuint shaderProgram, GLuint gridVAO, size_t vertexCount) {
     glDrawArrays(GL_LINES, 0, vertexCount / 3);
     glBindVertexArray(0);
 }
-std::vector<float> CreateGridVertices(float size, int divisions, const std::vector<Object>& objs) {
+void DrawLattice(GLuint latticeProgram, GLuint emptyVAO, const glm::mat4& projection) {
+    glUseProgram(latticeProgram);
+    glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+    glUniformMatrix4fv(glGetUniformLocation(latticeProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(latticeProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform1i(glGetUniformLocation(latticeProgram, "divisions"), latticeDivisions);
+    glUniform1i(glGetUniformLocation(latticeProgram, "sliceLo"), sliceLo);
+    glUniform1i(glGetUniformLocation(latticeProgram, "sliceHi"), sliceHi);
+    glUniform1f(glGetUniformLocation(latticeProgram, "latticeSize"), latticeSize);
+    glUniform1f(glGetUniformLocation(latticeProgram, "pullScale"), pullScale);
+
+    std::vector<glm::vec4> bodies;
+    for (const auto& obj : objs) {
+        if (bodies.size() == 64) break;
+        // rs comes out in metres, the lattice is in world units (km) like the CPU grid's distance * 1000
+        bodies.push_back(glm::vec4(obj.position, float((2 * G * obj.mass) / (c * c) / 1000.0)));
+    }
+    glUniform1i(glGetUniformLocation(latticeProgram, "bodyCount"), int(bodies.size()));
+    if (!bodies.empty()) {
+        glUniform4fv(glGetUniformLocation(latticeProgram, "bodies"), int(bodies.size()), glm::value_ptr(bodies[0]));
+    }
+
+    // x-lines and z-lines in every layer of the slice, y-lines between its layers
+    GLsizei P = latticeDivisions + 1;
+    GLsizei ny = sliceHi - sliceLo + 1;
+    GLsizei segments = 2 * latticeDivisions * ny * P + P * P * (ny - 1);
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_LINES, 0, 2 * segments);
+    glBindVertexArray(0);
+}
+std::vector<float> CreateGridVertices(float size, int divisions) {
     std::vector<float> vertices;
     float step = size / divisions;
     float halfSize = size / 2.0f;
@@ -578,9 +717,14 @@ std::vector<float> CreateGridVertices(float size, int divisions, const std::vect
     //     vertices[i+1] = vertexPos[1];
     //     vertices[i+2] = vertexPos[2];
     // }
-    float minz = 0.0f;
-    for (int i = 0; i < vertices.size(); i += 3) {
-        glm::vec3 vertexPos(vertices[i], vertices[i+1], vertices[i+2]);
+
+    return vertices;
+}
+
+// bends the grid under the current bodies, vertices is a copy of flat and is rewritten from it
+void UpdateGridVertices(std::vector<float>& vertices, const std::vector<float>& flat, const std::vector<Object>& objs) {
+    for (int i = 0; i < flat.size(); i += 3) {
+        glm::vec3 vertexPos(flat[i], flat[i+1], flat[i+2]);
         glm::vec3 totalDisplacement(0.0f);
         
 
@@ -601,7 +745,4 @@ std::vector<float> CreateGridVertices(float size, int divisions, const std::vect
 
          vertices[i+1] = vertexPos[1] / 15.0f - 3000.0f;
     }
-    
-
-    return vertices;
 }
\ No newline at end of file